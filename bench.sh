@@ -0,0 +1,250 @@
+#!/bin/bash
+#
+# Benchmarks for the xcowsay daemon.  Each one runs on a private session
+# bus so an X display is needed but nothing leaks into the desktop.
+#
+# Usage: BUILD_DIR=... ./bench.sh BENCHMARK...
+#
+
+set -e -u
+
+BUILD_DIR=${BUILD_DIR:-.}
+
+if [ -z "${XCOWSAY_PRIVATE_BUS:-}" ]; then
+   exec dbus-run-session -- env XCOWSAY_PRIVATE_BUS=1 "$0" "$@"
+fi
+
+export HOME=/nonexistent
+export XDG_CONFIG_HOME=/nonexistent
+export XCOWSAY_SOCKET=$(mktemp -u)
+
+SEND=$BUILD_DIR/src/xcowsay-send
+
+tmp=$(mktemp -d)
+pid=
+trap 'stop_daemon; rm -rf $tmp' EXIT
+
+now_ms() {
+   echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Start a daemon with the configuration file options given as arguments
+start_daemon() {
+   printf "%s\n" "$@" > $tmp/config
+   # Line buffered so the log is complete when the daemon is killed
+   stdbuf -oL $BUILD_DIR/src/xcowsay --daemon --debug \
+      --config=$tmp/config > $tmp/daemon.log &
+   pid=$!
+
+   for i in $(seq 50); do
+      if gdbus call --session --dest org.freedesktop.DBus \
+            --object-path /org/freedesktop/DBus \
+            --method org.freedesktop.DBus.NameHasOwner \
+            uk.me.doof.Cowsay | grep -q true; then
+         return
+      fi
+      sleep 0.1
+   done
+
+   echo "Daemon failed to start"
+   exit 1
+}
+
+stop_daemon() {
+   if [ -n "$pid" ]; then
+      kill $pid 2> /dev/null || true
+      wait $pid 2> /dev/null || true
+      pid=
+   fi
+}
+
+# Mean start-to-exit time in milliseconds of n runs of a client
+client_time() {
+   local n=$1
+   shift
+
+   local start=$(now_ms)
+   for i in $(seq $n); do
+      "$@" "Client message $i"
+   done
+   awk -v ms=$(( $(now_ms) - start )) -v n=$n \
+      'BEGIN { printf "%.1f", ms / n }'
+}
+
+bench_client() {
+   local n=20
+   local config=("display_time = 0" "min_display_time = 0"
+                 "lead_in_time = 0" "lead_out_time = 0" "coalesce = false")
+   local client=($BUILD_DIR/src/xcowsay --config=$tmp/config -t 0)
+
+   echo "Mean start-to-exit time of $n client runs"
+
+   start_daemon "queue_size = 0" "${config[@]}"
+   echo "  xcowsay with daemon:    $(client_time $n "${client[@]}")ms"
+   echo "  xcowsay-send:           $(client_time $n $SEND)ms"
+   stop_daemon
+
+   # The client shows the cow itself for no time at all
+   printf "%s\n" "${config[@]}" > $tmp/config
+   echo "  xcowsay without daemon: $(client_time $n "${client[@]}")ms"
+}
+
+# Fill the queue with messages that each stay up for a few seconds.
+# The sender has a session of its own so it is never the same client
+# as the one measured even with group_by_session set.
+saturate() {
+   local n=$1
+   for i in $(seq $n); do
+      printf "Chatty message %d\0" $i
+   done | setsid -w $SEND --null
+}
+
+# Time from sending an urgent message until it has been dismissed
+urgent_wait() {
+   local start=$(now_ms)
+   $SEND --priority=critical -t 0.1 --wait "Urgent message"
+   echo $(( $(now_ms) - start ))
+}
+
+bench_priority() {
+   local size=256 display=5000
+
+   local common=("queue_size = $size" "display_time = $display"
+                 "min_display_time = 0" "lead_in_time = 0"
+                 "lead_out_time = 0")
+
+   echo "Worst-case wait for a critical message behind $size queued"
+   echo "messages of ${display}ms each (includes 100ms display time)"
+
+   start_daemon "${common[@]}" "preempt_priority = 2"
+   saturate $size
+   echo "  jump queue and preempt: $(urgent_wait)ms"
+   stop_daemon
+
+   start_daemon "${common[@]}" "preempt_priority = 3"
+   saturate $size
+   echo "  jump queue only:        $(urgent_wait)ms"
+   stop_daemon
+
+   echo "  strict FIFO (computed): $(( size * display ))ms"
+}
+
+bench_fairness() {
+   local size=256 display=1000
+
+   echo "Wait for one message from a second client while another has"
+   echo "$size messages of ${display}ms each queued"
+
+   start_daemon "queue_size = $size" "display_time = $display" \
+      "min_display_time = 0" "lead_in_time = 0" "lead_out_time = 0"
+   saturate $size
+
+   local start=$(now_ms)
+   $SEND -t 0.1 --wait "Quiet client"
+   echo "  round robin:            $(( $(now_ms) - start ))ms"
+   stop_daemon
+
+   echo "  strict FIFO (computed): $(( size * display ))ms"
+}
+
+# Send n messages in one go and print how many were accepted per second
+ingest_rate() {
+   local n=$1
+   shift
+
+   for i in $(seq $n); do
+      printf "Message %d\0" $i
+   done > $tmp/messages
+
+   local start=$(now_ms)
+   "$@" $SEND --null < $tmp/messages
+   local elapsed=$(( $(now_ms) - start ))
+   echo $(( n * 1000 / (elapsed > 0 ? elapsed : 1) ))
+}
+
+bench_ingest() {
+   local n=10000
+
+   echo "Messages per second accepted by the daemon in batches of $n"
+
+   start_daemon "queue_size = 0" "socket = true" "coalesce = false"
+   echo "  DBus ShowBatch:         $(ingest_rate $n)"
+   stop_daemon
+
+   # Hide the session bus from the client so it uses the socket
+   start_daemon "queue_size = 0" "socket = true" "coalesce = false"
+   while [ ! -S $XCOWSAY_SOCKET ]; do sleep 0.1; done
+   echo "  Unix socket:            $(ingest_rate $n \
+      env DBUS_SESSION_BUS_ADDRESS=unix:path=/nonexistent)"
+   stop_daemon
+}
+
+# Time from a request reaching an idle daemon until the cow is drawn
+bench_latency() {
+   local n=20
+
+   echo "Mean time from $n requests reaching an idle daemon until each"
+   echo "cow is first drawn"
+
+   start_daemon "display_time = 100" "min_display_time = 0" \
+      "lead_in_time = 0" "lead_out_time = 0" "coalesce = false"
+   for i in $(seq $n); do
+      $SEND -t 0.1 --wait "Message $i"
+   done
+   stop_daemon
+
+   printf "  request to first pixel: %sms\n" \
+      $(awk '/first drawn/ { sub(/.*first drawn /, ""); sum += $1; n++ }
+             END { printf "%.1f", n ? sum / n : 0 }' $tmp/daemon.log)
+}
+
+# Average time between one cow going away and the next appearing
+bench_gap() {
+   local n=50 words=$(printf "word %.0s" $(seq 200))
+
+   echo "Mean gap between $n queued cows with ${#words} characters each"
+
+   for setting in true false; do
+      start_daemon "queue_size = 0" "display_time = 200" \
+         "min_display_time = 0" "lead_in_time = 0" "lead_out_time = 0" \
+         "coalesce = false" "prerender = $setting"
+      for i in $(seq $n); do
+         printf "%d %s\0" $i "$words"
+      done | $SEND --null
+      $SEND -t 0.1 --wait "Last message"
+      stop_daemon
+
+      printf "  prerender = %-6s      %sms\n" $setting \
+         $(awk '/after the last one/ { sum += $(NF-4); n++ }
+                END { printf "%.1f", n ? sum / n : 0 }' $tmp/daemon.log)
+   done
+}
+
+# Cost of laying out the text of a bubble, which needs no daemon
+bench_text() {
+   if [ ! -x $BUILD_DIR/src/bubble-bench ]; then
+      echo "Run \"make -C $BUILD_DIR/src bubble-bench\" first"
+      exit 1
+   fi
+
+   $BUILD_DIR/src/bubble-bench
+}
+
+if [ $# -eq 0 ]; then
+   echo "Usage: $0 BENCHMARK..."
+   echo "Benchmarks: client latency priority fairness ingest gap text"
+   exit 1
+fi
+
+for b in "$@"; do
+   case $b in
+      client) bench_client ;;
+      priority) bench_priority ;;
+      fairness) bench_fairness ;;
+      ingest) bench_ingest ;;
+      latency) bench_latency ;;
+      gap) bench_gap ;;
+      text) bench_text ;;
+      *) echo "Unknown benchmark $b"; exit 1 ;;
+   esac
+done
@@ -0,0 +1,136 @@
+#!/bin/bash
+#
+# Kill the daemon with SIGKILL while it has messages queued and check
+# they are replayed from the journal when it starts again.  A second
+# daemon started while the first is running must not touch the journal.
+#
+
+set -e -u
+
+if ! command -v dbus-run-session > /dev/null \
+      || ! command -v gdbus > /dev/null; then
+   echo "dbus-run-session or gdbus not found; skipping"
+   exit 77
+fi
+
+# xcowsay-send is only built when DBus support is enabled
+if [ ! -x $BUILD_DIR/src/xcowsay-send ]; then
+   echo "xcowsay built without DBus support; skipping"
+   exit 77
+fi
+
+if [ -z "${XCOWSAY_PRIVATE_BUS:-}" ]; then
+   exec dbus-run-session -- env XCOWSAY_PRIVATE_BUS=1 "$0" "$@"
+fi
+
+export HOME=/nonexistent
+export XDG_CONFIG_HOME=/nonexistent
+
+SEND=$BUILD_DIR/src/xcowsay-send
+
+pid=
+tmp=$(mktemp -d)
+trap 'kill -9 $pid 2> /dev/null || true; rm -rf $tmp' EXIT
+
+export XDG_STATE_HOME=$tmp/state
+
+cat > $tmp/config <<EOF2
+journal = true
+display_time = 60000
+min_display_time = 60000
+lead_in_time = 0
+lead_out_time = 0
+EOF2
+
+start_daemon() {
+   $BUILD_DIR/src/xcowsay --daemon --debug --config=$tmp/config \
+      >> $tmp/daemon.log &
+   pid=$!
+
+   for i in $(seq 50); do
+      if gdbus call --session --dest org.freedesktop.DBus \
+            --object-path /org/freedesktop/DBus \
+            --method org.freedesktop.DBus.NameHasOwner \
+            uk.me.doof.Cowsay | grep -q true; then
+         return
+      fi
+      sleep 0.1
+   done
+
+   echo "Daemon failed to start"
+   exit 1
+}
+
+queued() {
+   $SEND --list | wc -l
+}
+
+echo Starting daemon
+start_daemon
+
+echo Queueing 10 messages
+for i in $(seq 10); do
+   printf "Message %d\0" $i
+done | $SEND --null --print-id > $tmp/ids
+
+# Cancel three of the queued messages; the first one is on screen
+for id in $(sed -n '2,4p' $tmp/ids); do
+   $SEND --cancel=$id
+done
+
+if [ $(queued) -ne 6 ]; then
+   echo "Expected 6 queued messages before the crash"
+   exit 1
+fi
+
+echo Starting a second daemon
+# It must leave the journal alone and exit when it cannot take the name
+if $BUILD_DIR/src/xcowsay --daemon --debug --config=$tmp/config \
+      > $tmp/second.log 2>&1; then
+   echo "Second daemon did not fail"
+   cat $tmp/second.log
+   exit 1
+fi
+
+if ! grep -q "in use by another daemon" $tmp/second.log; then
+   echo "Second daemon did not notice the journal was locked"
+   cat $tmp/second.log
+   exit 1
+fi
+
+if grep -q "Replayed" $tmp/second.log \
+      || [ -e $XDG_STATE_HOME/xcowsay/journal.old ]; then
+   echo "Second daemon replayed the journal"
+   cat $tmp/second.log
+   exit 1
+fi
+
+if [ $(queued) -ne 6 ]; then
+   echo "Expected 6 queued messages after the second daemon exited"
+   exit 1
+fi
+
+echo Killing daemon
+kill -9 $pid
+wait $pid 2> /dev/null || true
+pid=
+
+echo Restarting daemon
+start_daemon
+
+# The message which was on screen is shown again first
+n=$(queued)
+echo "$n messages queued after restart"
+if [ $n -ne 6 ]; then
+   cat $tmp/daemon.log
+   exit 1
+fi
+
+if [ -e $XDG_STATE_HOME/xcowsay/journal.old ]; then
+   echo "Old journal was not removed after replay"
+   exit 1
+fi
+
+kill $pid
+wait $pid || true
+pid=
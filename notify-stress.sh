@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+# Flood the daemon's notification server with Notify calls on a private
+# session bus and check every notification is eventually closed.
+#
+
+set -e -u
+
+if ! command -v dbus-run-session > /dev/null \
+      || ! command -v gdbus > /dev/null; then
+   echo "dbus-run-session or gdbus not found; skipping"
+   exit 77
+fi
+
+# xcowsay-send is only built when DBus support is enabled
+if [ ! -x $BUILD_DIR/src/xcowsay-send ]; then
+   echo "xcowsay built without DBus support; skipping"
+   exit 77
+fi
+
+# Never talk to the real notification daemon
+if [ -z "${XCOWSAY_PRIVATE_BUS:-}" ]; then
+   exec dbus-run-session -- env XCOWSAY_PRIVATE_BUS=1 "$0" "$@"
+fi
+
+export HOME=/nonexistent
+export XDG_CONFIG_HOME=/nonexistent
+
+COUNT=${NOTIFY_COUNT:-1000}
+PARALLEL=50
+
+pid=
+monitor=
+tmp=$(mktemp -d)
+trap 'kill $pid $monitor 2> /dev/null || true; rm -rf $tmp' EXIT
+
+cat > $tmp/config <<EOF
+notifications = true
+queue_size = 0
+lead_in_time = 0
+lead_out_time = 0
+EOF
+
+notify() {
+   gdbus call --session --dest org.freedesktop.Notifications \
+      --object-path /org/freedesktop/Notifications \
+      --method org.freedesktop.Notifications.Notify \
+      xcowsay-test "$1" "" "$2" "Body of $2" "[]" "{}" "$3" \
+      | sed 's/^(uint32 \([0-9]*\),)$/\1/'
+}
+
+close_notification() {
+   gdbus call --session --dest org.freedesktop.Notifications \
+      --object-path /org/freedesktop/Notifications \
+      --method org.freedesktop.Notifications.CloseNotification "$1" \
+      > /dev/null
+}
+
+echo Starting daemon
+$BUILD_DIR/src/xcowsay --daemon --debug --config=$tmp/config \
+   > $tmp/daemon.log &
+pid=$!
+
+for i in $(seq 50); do
+   if gdbus call --session --dest org.freedesktop.DBus \
+         --object-path /org/freedesktop/DBus \
+         --method org.freedesktop.DBus.NameHasOwner \
+         org.freedesktop.Notifications | grep -q true; then
+      break
+   fi
+   sleep 0.1
+done
+
+gdbus call --session --dest org.freedesktop.Notifications \
+   --object-path /org/freedesktop/Notifications \
+   --method org.freedesktop.Notifications.GetServerInformation
+
+gdbus monitor --session --dest org.freedesktop.Notifications \
+   > $tmp/monitor.log &
+monitor=$!
+sleep 0.5
+
+echo Replacing a notification in place
+id=$(notify 0 "Progress 0%" 0)
+for p in 10 20 30 40 50 60 70 80 90 100; do
+   new=$(notify $id "Progress $p%" 0)
+   if [ "$new" != "$id" ]; then
+      echo "Replacement got ID $new instead of $id"
+      exit 1
+   fi
+done
+close_notification $id
+
+echo Identical notifications have their own IDs
+first=$(notify 0 "Same" 60000)
+second=$(notify 0 "Same" 60000)
+if [ "$first" = "$second" ]; then
+   echo "Both notifications got ID $first"
+   exit 1
+fi
+close_notification $first
+close_notification $second
+
+echo "Sending $COUNT notifications"
+start=$(date +%s%N)
+seq $COUNT | xargs -P $PARALLEL -I{} \
+   gdbus call --session --dest org.freedesktop.Notifications \
+   --object-path /org/freedesktop/Notifications \
+   --method org.freedesktop.Notifications.Notify \
+   xcowsay-test 0 "" "Stress {}" "" "[]" "{}" 60000 \
+   | sed 's/^(uint32 \([0-9]*\),)$/\1/' > $tmp/ids
+end=$(date +%s%N)
+echo "Sent $COUNT notifications in $(( (end - start) / 1000000 ))ms"
+
+unique=$(sort -u $tmp/ids | wc -l)
+if [ $unique -ne $COUNT ]; then
+   echo "Expected $COUNT unique IDs but got $unique"
+   exit 1
+fi
+
+echo Closing all notifications
+xargs -P $PARALLEL -n 1 < $tmp/ids \
+   gdbus call --session --dest org.freedesktop.Notifications \
+   --object-path /org/freedesktop/Notifications \
+   --method org.freedesktop.Notifications.CloseNotification > /dev/null
+
+# One each for the replaced and identical notifications and the others
+expect=$((COUNT + 3))
+for i in $(seq 100); do
+   closed=$(grep -c NotificationClosed $tmp/monitor.log || true)
+   [ $closed -ge $expect ] && break
+   sleep 0.1
+done
+
+echo "Saw $closed of $expect NotificationClosed signals"
+[ $closed -ge $expect ]
+
+kill $pid
+wait $pid || true
@@ -0,0 +1,80 @@
+#!/bin/bash
+#
+# Send messages from a loop in one session until the rate limit is
+# reached and check a client in another session is still accepted.
+#
+
+set -e -u
+
+if ! command -v dbus-run-session > /dev/null \
+      || ! command -v gdbus > /dev/null \
+      || ! command -v setsid > /dev/null; then
+   echo "dbus-run-session, gdbus or setsid not found; skipping"
+   exit 77
+fi
+
+# xcowsay-send is only built when DBus support is enabled
+if [ ! -x $BUILD_DIR/src/xcowsay-send ]; then
+   echo "xcowsay built without DBus support; skipping"
+   exit 77
+fi
+
+if [ -z "${XCOWSAY_PRIVATE_BUS:-}" ]; then
+   exec dbus-run-session -- env XCOWSAY_PRIVATE_BUS=1 "$0" "$@"
+fi
+
+export HOME=/nonexistent
+export XDG_CONFIG_HOME=/nonexistent
+
+SEND=$BUILD_DIR/src/xcowsay-send
+BURST=3
+
+pid=
+tmp=$(mktemp -d)
+trap 'kill $pid 2> /dev/null || true; rm -rf $tmp' EXIT
+
+cat > $tmp/config <<EOF2
+rate_limit = 1
+rate_burst = $BURST
+group_by_session = true
+queue_size = 0
+display_time = 60000
+min_display_time = 60000
+lead_in_time = 0
+lead_out_time = 0
+EOF2
+
+echo Starting daemon
+$BUILD_DIR/src/xcowsay --daemon --debug --config=$tmp/config \
+   > $tmp/daemon.log &
+pid=$!
+
+for i in $(seq 50); do
+   if gdbus call --session --dest org.freedesktop.DBus \
+         --object-path /org/freedesktop/DBus \
+         --method org.freedesktop.DBus.NameHasOwner \
+         uk.me.doof.Cowsay | grep -q true; then
+      break
+   fi
+   sleep 0.1
+done
+
+echo "Sending $BURST messages from one session"
+for i in $(seq $BURST); do
+   $SEND "Message $i"
+done
+
+echo Sending one more from the same session
+if $SEND "One too many" 2> $tmp/error; then
+   echo "Message over the limit was accepted"
+   exit 1
+fi
+grep "Too many requests" $tmp/error
+
+echo Sending from a new session
+setsid -w $SEND "Another client"
+
+grep -q "is session:" $tmp/daemon.log
+
+kill $pid
+wait $pid || true
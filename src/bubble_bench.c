@@ -0,0 +1,139 @@
+/*  bubble_bench.c -- Measure the cost of laying out bubble text.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Not installed: build with "make -C src bubble-bench".  No display is
+ * needed as the bubbles are only drawn into image surfaces.
+ *
+ * Usage: bubble-bench [ITERATIONS] [FONT]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pango/pangocairo.h>
+
+#include "bubblegen.h"
+
+#define DEF_ITERATIONS 10000
+#define DEF_FONT       "Bitstream Vera Sans 14"
+#define MAX_WIDTH      800
+
+static const char *samples[] = {
+   "Moo!",
+   "Hello, <b>World</b>!",
+   "Najib said \"السلام عليكم\" to me.",
+   "The quick brown fox jumps over the lazy dog "
+   "and then the cow jumps over the moon",
+   "中文 日本語 한국어",
+};
+
+#define NUM_SAMPLES (sizeof(samples) / sizeof(samples[0]))
+
+// What make_text_bubble used to do for every message
+static void fresh_text_size(const char *text, const bubble_params_t *params,
+                            int *width, int *height)
+{
+   PangoFontMap *font_map = pango_cairo_font_map_get_default();
+   PangoContext *context = pango_font_map_create_context(font_map);
+   pango_cairo_context_set_resolution(context, params->resolution);
+
+   PangoLayout *layout = pango_layout_new(context);
+   PangoFontDescription *font =
+      pango_font_description_from_string(params->font);
+
+   pango_layout_set_width(layout, MAX_WIDTH * PANGO_SCALE);
+   pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
+
+   PangoAttrList *attrs = NULL;
+   char *stripped = NULL;
+   if (pango_parse_markup(text, -1, 0, &attrs, &stripped, NULL, NULL)) {
+      pango_layout_set_attributes(layout, attrs);
+      pango_layout_set_text(layout, stripped, -1);
+      pango_attr_list_unref(attrs);
+      g_free(stripped);
+   }
+   else
+      pango_layout_set_text(layout, text, -1);
+
+   pango_context_set_base_dir(context, pango_find_base_dir(text, -1));
+   pango_layout_set_font_description(layout, font);
+   pango_layout_get_pixel_size(layout, width, height);
+
+   pango_font_description_free(font);
+   g_object_unref(layout);
+   g_object_unref(context);
+}
+
+static void cached_text_size(const char *text, const bubble_params_t *params,
+                             int *width, int *height)
+{
+   bubble_text_size(text, MAX_WIDTH, params, width, height);
+}
+
+static void full_bubble(const char *text, const bubble_params_t *params,
+                        int *width, int *height)
+{
+   cairo_surface_destroy(make_text_bubble(text, width, height, MAX_WIDTH,
+                                          COWMODE_NORMAL, params));
+}
+
+typedef void (*bench_fn_t)(const char *, const bubble_params_t *,
+                           int *, int *);
+
+static void run(const char *name, bench_fn_t fn, int iterations,
+                const bubble_params_t *params)
+{
+   int width, height;
+
+   // The first call loads the fonts which is not what we want to measure
+   for (int i = 0; i < (int)NUM_SAMPLES; i++)
+      (*fn)(samples[i], params, &width, &height);
+
+   const gint64 start = g_get_monotonic_time();
+   for (int i = 0; i < iterations; i++)
+      (*fn)(samples[i % NUM_SAMPLES], params, &width, &height);
+   const gint64 elapsed = g_get_monotonic_time() - start;
+
+   printf("  %-28s %8.2fus\n", name, (double)elapsed / iterations);
+}
+
+int main(int argc, char **argv)
+{
+   const int iterations = argc > 1 ? atoi(argv[1]) : DEF_ITERATIONS;
+
+   bubble_params_t params = {
+      .font = argc > 2 ? argv[2] : (char *)DEF_FONT,
+      .wrap = true,
+      .left = false,
+      .resolution = 96.0,
+      .font_options = NULL,
+   };
+
+   printf("Mean time per bubble over %d iterations with %s\n",
+          iterations, params.font);
+   run("text setup (new objects):", fresh_text_size, iterations, &params);
+   run("text setup (reused):", cached_text_size, iterations, &params);
+   run("complete bubble:", full_bubble, iterations, &params);
+
+   return 0;
+}
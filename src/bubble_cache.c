@@ -0,0 +1,140 @@
+/*  bubble_cache.c -- Keep recently rendered bubbles for reuse.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Daemons tend to show the same few messages over and over so the
+ * finished bubbles are kept in a hash table with the most recently
+ * used at the head of a list.  Only the GTK thread uses the cache so
+ * there is no locking.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bubble_cache.h"
+
+typedef struct {
+   GList link;              // Data points back at the entry
+   char *key;
+   cairo_surface_t *surface;
+   int width, height;
+   gsize size;
+} entry_t;
+
+static GHashTable *entries = NULL;   // Keys to entries
+static GQueue lru = G_QUEUE_INIT;    // Most recently used first
+static bubble_cache_stats_t stats;
+
+char *bubble_cache_key(const char *text, cowmode_t mode, int max_width,
+                       const bubble_params_t *params)
+{
+   if (COWMODE_DREAM == mode)
+      return NULL;   // The image may change on disk
+
+   const unsigned long options = params->font_options
+      ? cairo_font_options_hash(params->font_options) : 0;
+
+   // The text goes last so it cannot be confused with the other fields
+   return g_strdup_printf("%d:%d:%d:%d:%g:%lx:%s\n%s", mode, params->wrap,
+                          params->left, max_width, params->resolution,
+                          options, params->font, text);
+}
+
+static void free_entry(entry_t *e)
+{
+   g_free(e->key);
+   cairo_surface_destroy(e->surface);
+   g_free(e);
+}
+
+static void remove_entry(entry_t *e)
+{
+   g_queue_unlink(&lru, &e->link);
+   g_hash_table_remove(entries, e->key);
+   stats.bytes -= e->size;
+   stats.entries--;
+   free_entry(e);
+}
+
+cairo_surface_t *bubble_cache_lookup(const char *key, int *width,
+                                     int *height)
+{
+   entry_t *e = entries ? g_hash_table_lookup(entries, key) : NULL;
+   if (NULL == e) {
+      stats.misses++;
+      return NULL;
+   }
+
+   stats.hits++;
+
+   g_queue_unlink(&lru, &e->link);
+   g_queue_push_head_link(&lru, &e->link);
+
+   *width = e->width;
+   *height = e->height;
+   return cairo_surface_reference(e->surface);
+}
+
+void bubble_cache_insert(const char *key, cairo_surface_t *surface,
+                         int width, int height, gsize budget)
+{
+   const gsize size = (gsize)cairo_image_surface_get_stride(surface)
+      * cairo_image_surface_get_height(surface);
+   if (size > budget)
+      return;
+
+   if (NULL == entries)
+      entries = g_hash_table_new(g_str_hash, g_str_equal);
+
+   // Two renders of the same text may finish one after the other
+   entry_t *old = g_hash_table_lookup(entries, key);
+   if (old != NULL)
+      remove_entry(old);
+
+   while (stats.bytes + size > budget) {
+      remove_entry(g_queue_peek_tail_link(&lru)->data);
+      stats.evictions++;
+   }
+
+   entry_t *e = g_new0(entry_t, 1);
+   e->link.data = e;
+   e->key = g_strdup(key);
+   e->surface = cairo_surface_reference(surface);
+   e->width = width;
+   e->height = height;
+   e->size = size;
+
+   g_queue_push_head_link(&lru, &e->link);
+   g_hash_table_insert(entries, e->key, e);
+   stats.bytes += size;
+   stats.entries++;
+}
+
+void bubble_cache_stats(bubble_cache_stats_t *out)
+{
+   *out = stats;
+}
+
+void bubble_cache_clear(void)
+{
+   while (lru.head != NULL)
+      remove_entry(lru.head->data);
+}
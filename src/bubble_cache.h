@@ -0,0 +1,50 @@
+/*  bubble_cache.h -- Keep recently rendered bubbles for reuse.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_BUBBLE_CACHE_H
+#define INC_BUBBLE_CACHE_H
+
+#include <cairo.h>
+
+#include "xcowsay.h"
+#include "bubblegen.h"
+
+typedef struct {
+   guint64 hits, misses, evictions;
+   guint entries;
+   gsize bytes;            // Pixel data held by the cache
+} bubble_cache_stats_t;
+
+// Key covering everything the pixels of a bubble depend on or NULL if
+// the bubble should not be cached.  Free with g_free.
+char *bubble_cache_key(const char *text, cowmode_t mode, int max_width,
+                       const bubble_params_t *params);
+
+// Returns a new reference to the bubble for key and counts a hit or a
+// miss.  The surface must not be drawn on.
+cairo_surface_t *bubble_cache_lookup(const char *key, int *width,
+                                     int *height);
+
+// Keeps a reference to the surface and throws away the least recently
+// used bubbles so the cache holds no more than budget bytes
+void bubble_cache_insert(const char *key, cairo_surface_t *surface,
+                         int width, int height, gsize budget);
+
+void bubble_cache_stats(bubble_cache_stats_t *stats);
+void bubble_cache_clear(void);
+
+#endif
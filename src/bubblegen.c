@@ -23,13 +23,14 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
 
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <pango/pangocairo.h>
 
-#include "floating_shape.h"
-#include "display_cow.h"
+#include "bubblegen.h"
 #include "settings.h"
 #include "i18n.h"
 
@@ -56,8 +57,16 @@
 // Min distance from top of the big circle to the top of the bubble
 #define CIRCLE_TOP_MIN  10
 
+#define FONT_CACHE_SIZE 16   // Parsed fonts kept by each thread
+
+// Pixels either side of a corner's centre which its arcs can touch
+#define CORNER_PAD        4
+
+#define CHROME_CACHE_SIZE 32   // Bubble heights kept for each style
+
 typedef struct {
    int width, height;
+   bool left;
    cairo_surface_t *surface;
    cairo_t *cr;
 } bubble_t;
@@ -70,7 +79,7 @@ static void bubble_corner_arcs(bubble_t *b, bubble_style_t style,
    // Space between cow and bubble
    int middle = (style == NORMAL ? TIP_WIDTH : THINK_WIDTH);
 
-   if (get_bool_option("left")) {
+   if (b->left) {
       corners[0][0] = BUBBLE_BORDER + CORNER_RADIUS;
       corners[0][1] = BUBBLE_BORDER + CORNER_RADIUS;
 
@@ -101,7 +110,7 @@ static void bubble_corner_arcs(bubble_t *b, bubble_style_t style,
 static void bubble_init_cairo(bubble_t *b, cairo_t *cr, bubble_style_t style)
 {
    GdkPoint tip_points[5];
-   bool right = !get_bool_option("left");
+   bool right = !b->left;
 
    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.0);
    cairo_rectangle(cr, 0, 0, b->width, b->height);
@@ -286,15 +295,144 @@ static void bubble_init_cairo(bubble_t *b, cairo_t *cr, bubble_style_t style)
    cairo_stroke(cr);
 }
 
-static void bubble_init(bubble_t *b, bubble_style_t style)
+/*
+ * Apart from the tip and the think circles, which are positioned as a
+ * fraction of the height, every part of the chrome is a fixed distance
+ * from the left or right edge.  So all bubbles of the same style and
+ * height are the same except for how many copies there are of the
+ * plain columns between the corners.  One narrow bubble is drawn for
+ * each height and wider ones are made by copying its left and right
+ * parts and repeating the column in the middle, which gives exactly
+ * the same pixels as drawing them.
+ */
+typedef struct {
+   bubble_style_t style;
+   bool left;
+   int height;
+   cairo_surface_t *surface;   // Narrowest bubble with a plain column
+} chrome_t;
+
+static GMutex chrome_lock;
+static chrome_t chrome_cache[CHROME_CACHE_SIZE];
+static int chrome_next = 0;   // Entry to replace next
+
+// Columns copied from the left and right of the narrow bubble
+static void chrome_parts(bubble_style_t style, bool left, int *lpart,
+                         int *rpart)
+{
+   const int middle = style == NORMAL ? TIP_WIDTH : THINK_WIDTH;
+   *lpart = BUBBLE_BORDER + CORNER_RADIUS + CORNER_PAD + (left ? 0 : middle);
+   *rpart = 2*BUBBLE_BORDER + CORNER_RADIUS + CORNER_PAD + (left ? middle : 0);
+}
+
+static cairo_surface_t *draw_chrome(int width, int height,
+                                    bubble_style_t style, bool left)
+{
+   bubble_t b = { .width = width, .height = height, .left = left };
+
+   cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+   g_assert(surface);
+
+   cairo_t *cr = cairo_create(surface);
+   bubble_init_cairo(&b, cr, style);
+   cairo_destroy(cr);
+
+   cairo_surface_flush(surface);
+   return surface;
+}
+
+static cairo_surface_t *narrow_chrome(int height, bubble_style_t style,
+                                      bool left)
 {
-   b->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-                                           b->width, b->height);
-   g_assert(b->surface);
+   cairo_surface_t *surface = NULL;
+
+   g_mutex_lock(&chrome_lock);
+   for (int i = 0; i < CHROME_CACHE_SIZE && surface == NULL; i++) {
+      const chrome_t *c = &chrome_cache[i];
+      if (c->surface != NULL && c->style == style && c->left == left
+          && c->height == height)
+         surface = cairo_surface_reference(c->surface);
+   }
+   g_mutex_unlock(&chrome_lock);
+
+   if (surface != NULL)
+      return surface;
+
+   // Two threads may both draw the same one but that does no harm
+   int lpart, rpart;
+   chrome_parts(style, left, &lpart, &rpart);
+   surface = draw_chrome(lpart + 1 + rpart, height, style, left);
+
+   g_mutex_lock(&chrome_lock);
+   chrome_t *c = &chrome_cache[chrome_next];
+   chrome_next = (chrome_next + 1) % CHROME_CACHE_SIZE;
+   if (c->surface != NULL)
+      cairo_surface_destroy(c->surface);
+   c->style = style;
+   c->left = left;
+   c->height = height;
+   c->surface = cairo_surface_reference(surface);
+   g_mutex_unlock(&chrome_lock);
+
+   return surface;
+}
+
+static cairo_surface_t *stretch_chrome(int width, int height,
+                                       bubble_style_t style, bool left)
+{
+   int lpart, rpart;
+   chrome_parts(style, left, &lpart, &rpart);
+
+   if (width < lpart + rpart)
+      return draw_chrome(width, height, style, left);   // Too narrow
+
+   cairo_surface_t *narrow = narrow_chrome(height, style, left);
+   const int nwidth = cairo_image_surface_get_width(narrow);
+   const int nstride = cairo_image_surface_get_stride(narrow);
+   const unsigned char *src = cairo_image_surface_get_data(narrow);
+
+   cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+   g_assert(surface);
+
+   const int stride = cairo_image_surface_get_stride(surface);
+   unsigned char *dst = cairo_image_surface_get_data(surface);
+
+   for (int y = 0; y < height; y++) {
+      const uint32_t *srow = (const uint32_t *)(src + y * nstride);
+      uint32_t *drow = (uint32_t *)(dst + y * stride);
+
+      memcpy(drow, srow, lpart * sizeof(uint32_t));
+      for (int x = lpart; x < width - rpart; x++)
+         drow[x] = srow[lpart];
+      memcpy(drow + width - rpart, srow + nwidth - rpart,
+             rpart * sizeof(uint32_t));
+   }
 
+   cairo_surface_mark_dirty(surface);
+   cairo_surface_destroy(narrow);
+   return surface;
+}
+
+cairo_surface_t *make_bubble_chrome(int width, int height, cowmode_t mode,
+                                    bool left, bool cached)
+{
+   bubble_style_t style = mode == COWMODE_NORMAL ? NORMAL : THOUGHT;
+   if (cached)
+      return stretch_chrome(width, height, style, left);
+   else
+      return draw_chrome(width, height, style, left);
+}
+
+static void bubble_init(bubble_t *b, bubble_style_t style)
+{
+   b->surface = stretch_chrome(b->width, b->height, style, b->left);
    b->cr = cairo_create(b->surface);
 
-   bubble_init_cairo(b, b->cr, style);
+   // The rest of the bubble is drawn inside the border
+   b->width -= BUBBLE_BORDER;
+   b->height -= BUBBLE_BORDER;
 }
 
 static void bubble_size_from_content(bubble_t *b, bubble_style_t style,
@@ -305,18 +443,17 @@ static void bubble_size_from_content(bubble_t *b, bubble_style_t style,
    b->height = BUBBLE_BORDER + CORNER_DIAM + c_height;
 }
 
-static GdkPixbuf *bubble_tidy(bubble_t *b)
+// The surface is already premultiplied ARGB which is what is painted
+// onto the window so it is handed over as it is
+static cairo_surface_t *bubble_tidy(bubble_t *b)
 {
-   GdkPixbuf *pixbuf =
-      gdk_pixbuf_get_from_surface(b->surface, 0, 0, b->width + BUBBLE_BORDER, b->height + BUBBLE_BORDER);
-
-   cairo_surface_destroy(b->surface);
-   return pixbuf;
+   cairo_surface_flush(b->surface);
+   return b->surface;
 }
 
-static int bubble_content_left(bubble_style_t style)
+static int bubble_content_left(const bubble_t *b, bubble_style_t style)
 {
-   if (get_bool_option("left")) {
+   if (b->left) {
       return BUBBLE_BORDER + CORNER_RADIUS;
    }
    else {
@@ -330,48 +467,102 @@ static int bubble_content_top()
    return CORNER_RADIUS;
 }
 
-GdkPixbuf *make_dream_bubble(const char *file, int *p_width, int *p_height)
+void bubble_params_init(bubble_params_t *params)
 {
-   bubble_t bubble;
-   GError *error = NULL;
-   GdkPixbuf *image = gdk_pixbuf_new_from_file(file, &error);
+   GdkScreen *screen = gdk_screen_get_default();
+   const cairo_font_options_t *font_options =
+      gdk_screen_get_font_options(screen);
+
+   params->font = g_strdup(get_string_option("font"));
+   params->wrap = get_bool_option("wrap");
+   params->left = get_bool_option("left");
+   params->resolution = gdk_screen_get_resolution(screen);
+   params->font_options =
+      font_options ? cairo_font_options_copy(font_options) : NULL;
+}
 
-   if (NULL == image) {
-      fprintf(stderr, "Error: failed to load %s\n", file);
-      exit(1);
-   }
+void bubble_params_free(bubble_params_t *params)
+{
+   g_free(params->font);
+   if (params->font_options != NULL)
+      cairo_font_options_destroy(params->font_options);
+}
 
-   bubble_size_from_content(&bubble, THOUGHT, gdk_pixbuf_get_width(image),
-                            gdk_pixbuf_get_height(image));
-   *p_width = bubble.width;
-   *p_height = bubble.height;
+// Pango objects kept for every bubble rendered on one thread
+typedef struct {
+   PangoContext *context;
+   PangoLayout *layout;
+   GHashTable *fonts;      // Parsed font descriptions by name
+} text_state_t;
 
-   bubble_init(&bubble, THOUGHT);
+static void free_text_state(gpointer data)
+{
+   text_state_t *ts = data;
+   g_object_unref(ts->layout);
+   g_object_unref(ts->context);
+   g_hash_table_destroy(ts->fonts);
+   g_free(ts);
+}
 
-   gdk_cairo_set_source_pixbuf(bubble.cr, image,
-                               bubble_content_left(THOUGHT),
-                               bubble_content_top());
-   cairo_paint(bubble.cr);
+/*
+ * The GDK Pango context can only be used from the GTK thread so each
+ * thread makes its own from the thread's default font map.  Setting up
+ * the context and parsing the font are not free so they are done once
+ * per thread rather than for every bubble.
+ */
+static text_state_t *thread_text_state(void)
+{
+   static GPrivate key = G_PRIVATE_INIT(free_text_state);
 
-   cairo_destroy(bubble.cr);
-   g_object_unref(image);
+   text_state_t *ts = g_private_get(&key);
+   if (NULL == ts) {
+      ts = g_new0(text_state_t, 1);
 
-   return bubble_tidy(&bubble);
+      PangoFontMap *font_map = pango_cairo_font_map_get_default();
+      ts->context = pango_font_map_create_context(font_map);
+      ts->layout = pango_layout_new(ts->context);
+      ts->fonts = g_hash_table_new_full(
+         g_str_hash, g_str_equal, g_free,
+         (GDestroyNotify)pango_font_description_free);
+
+      g_private_set(&key, ts);
+   }
+
+   return ts;
 }
 
-GdkPixbuf *make_text_bubble(char *text, int *p_width, int *p_height,
-                            int max_width, cowmode_t mode)
+static const PangoFontDescription *cached_font(text_state_t *ts,
+                                               const char *name)
 {
-   bubble_t bubble;
-   int text_width, text_height;
+   PangoFontDescription *font = g_hash_table_lookup(ts->fonts, name);
+   if (NULL == font) {
+      // Clients can ask for any font so do not let this grow forever
+      if (g_hash_table_size(ts->fonts) >= FONT_CACHE_SIZE)
+         g_hash_table_remove_all(ts->fonts);
+
+      font = pango_font_description_from_string(name);
+      g_hash_table_insert(ts->fonts, g_strdup(name), font);
+   }
 
-   // Work out the size of the bubble from the text
-   PangoContext *pango_context = gdk_pango_context_get();
-   PangoLayout *layout = pango_layout_new(pango_context);
-   PangoFontDescription *font =
-      pango_font_description_from_string(get_string_option("font"));
-   PangoAttrList *pango_attrs = NULL;
-   PangoDirection text_direction = PANGO_DIRECTION_NEUTRAL;
+   return font;
+}
+
+/*
+ * Set up the thread's layout for the text.  Everything set by a
+ * previous bubble is reset.  The layout is only valid until the next
+ * call on the same thread.
+ */
+static PangoLayout *text_layout(const char *text, int max_width,
+                                const bubble_params_t *params)
+{
+   text_state_t *ts = thread_text_state();
+   PangoLayout *layout = ts->layout;
+
+   pango_cairo_context_set_resolution(ts->context, params->resolution);
+   pango_cairo_context_set_font_options(ts->context, params->font_options);
+   pango_context_set_base_dir(ts->context,
+                              pango_find_base_dir(text, strlen(text)));
+   pango_layout_context_changed(layout);
 
    // Adjust max width to account for bubble edges
    max_width -= LEFT_BUF;
@@ -379,27 +570,80 @@ GdkPixbuf *make_text_bubble(char *text, int *p_width, int *p_height,
    max_width -= 2 * BUBBLE_BORDER;
    max_width -= CORNER_DIAM;
 
-   if (get_bool_option("wrap")) {
+   if (params->wrap) {
       pango_layout_set_width(layout, max_width * PANGO_SCALE);
       pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
    }
+   else
+      pango_layout_set_width(layout, -1);
 
-   char *stripped;
+   PangoAttrList *pango_attrs = NULL;
+   char *stripped = NULL;
    if (!pango_parse_markup(text, -1, 0, &pango_attrs,
          &stripped, NULL, NULL)) {
 
       // This isn't fatal as the text may contain angled brackets, etc.
-      stripped = text;
+      pango_layout_set_attributes(layout, NULL);
+      pango_layout_set_text(layout, text, -1);
    }
    else {
       pango_layout_set_attributes(layout, pango_attrs);
+      pango_layout_set_text(layout, stripped, -1);
+      pango_attr_list_unref(pango_attrs);
+      g_free(stripped);
    }
 
-   text_direction = pango_find_base_dir(text, strlen(text));
-   pango_context_set_base_dir(pango_context, text_direction);
+   pango_layout_set_font_description(layout, cached_font(ts, params->font));
 
-   pango_layout_set_font_description(layout, font);
-   pango_layout_set_text(layout, stripped, -1);
+   return layout;
+}
+
+void bubble_text_size(const char *text, int max_width,
+                      const bubble_params_t *params, int *width, int *height)
+{
+   PangoLayout *layout = text_layout(text, max_width, params);
+   pango_layout_get_pixel_size(layout, width, height);
+}
+
+cairo_surface_t *make_dream_bubble(const char *file, int *p_width,
+                                   int *p_height,
+                                   const bubble_params_t *params,
+                                   GError **error)
+{
+   bubble_t bubble = { .left = params->left };
+   GdkPixbuf *image = gdk_pixbuf_new_from_file(file, error);
+
+   if (NULL == image)
+      return NULL;
+
+   bubble_size_from_content(&bubble, THOUGHT, gdk_pixbuf_get_width(image),
+                            gdk_pixbuf_get_height(image));
+   *p_width = bubble.width;
+   *p_height = bubble.height;
+
+   bubble_init(&bubble, THOUGHT);
+
+   gdk_cairo_set_source_pixbuf(bubble.cr, image,
+                               bubble_content_left(&bubble, THOUGHT),
+                               bubble_content_top());
+   cairo_paint(bubble.cr);
+
+   cairo_destroy(bubble.cr);
+   g_object_unref(image);
+
+   return bubble_tidy(&bubble);
+}
+
+cairo_surface_t *make_text_bubble(const char *text, int *p_width,
+                                  int *p_height, int max_width,
+                                  cowmode_t mode,
+                                  const bubble_params_t *params)
+{
+   bubble_t bubble = { .left = params->left };
+   int text_width, text_height;
+
+   // Work out the size of the bubble from the text
+   PangoLayout *layout = text_layout(text, max_width, params);
    pango_layout_get_pixel_size(layout, &text_width, &text_height);
 
    bubble_style_t style = mode == COWMODE_NORMAL ? NORMAL : THOUGHT;
@@ -411,17 +655,11 @@ GdkPixbuf *make_text_bubble(char *text, int *p_width, int *p_height,
    bubble_init(&bubble, style);
 
    // Render the text
-   cairo_move_to(bubble.cr, bubble_content_left(style), bubble_content_top());
+   cairo_move_to(bubble.cr, bubble_content_left(&bubble, style),
+                 bubble_content_top());
    pango_cairo_show_layout(bubble.cr, layout);
 
    cairo_destroy(bubble.cr);
 
-   // Make sure to free the Pango objects
-   g_object_unref(pango_context);
-   g_object_unref(layout);
-   pango_font_description_free(font);
-   if (NULL != pango_attrs)
-      pango_attr_list_unref(pango_attrs);
-
    return bubble_tidy(&bubble);
 }
@@ -0,0 +1,68 @@
+/*  bubblegen.h -- Generate various sorts of bubbles.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_BUBBLEGEN_H
+#define INC_BUBBLEGEN_H
+
+#include <stdbool.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo.h>
+
+#include "xcowsay.h"
+
+/*
+ * Everything the bubble depends on apart from its contents.  The
+ * options are copied out of the settings on the GTK thread so bubbles
+ * can be generated on any thread.
+ */
+typedef struct {
+   char *font;
+   bool wrap;
+   bool left;
+   double resolution;                    // Screen DPI or -1
+   cairo_font_options_t *font_options;   // May be NULL
+} bubble_params_t;
+
+// Fill in the parameters from the current settings and default screen.
+// Must be called on the GTK thread.
+void bubble_params_init(bubble_params_t *params);
+void bubble_params_free(bubble_params_t *params);
+
+// The bubbles are premultiplied ARGB image surfaces
+cairo_surface_t *make_text_bubble(const char *text, int *p_width,
+                                  int *p_height, int max_width,
+                                  cowmode_t mode,
+                                  const bubble_params_t *params);
+
+// Just the outline and background of a bubble, either from scratch or
+// assembled from a cached narrow bubble of the same height.  These
+// should be identical.
+cairo_surface_t *make_bubble_chrome(int width, int height, cowmode_t mode,
+                                    bool left, bool cached);
+
+// Size in pixels of the text as it would be laid out in a bubble
+void bubble_text_size(const char *text, int max_width,
+                      const bubble_params_t *params, int *width, int *height);
+
+// Returns NULL if the image cannot be loaded
+cairo_surface_t *make_dream_bubble(const char *file, int *p_width,
+                                   int *p_height,
+                                   const bubble_params_t *params,
+                                   GError **error);
+
+#endif
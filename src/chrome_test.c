@@ -0,0 +1,97 @@
+/*  chrome_test.c -- Check bubbles built from cached chrome look the same.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares every pixel of the bubble outline drawn from scratch with
+ * the one assembled from the cache over a range of sizes.  No display
+ * is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bubblegen.h"
+
+#define MIN_SIZE  60
+#define MAX_SIZE  400
+
+// Returns the number of pixels that differ
+static int compare(int width, int height, cowmode_t mode, bool left)
+{
+   cairo_surface_t *drawn =
+      make_bubble_chrome(width, height, mode, left, false);
+   cairo_surface_t *cached =
+      make_bubble_chrome(width, height, mode, left, true);
+
+   cairo_surface_flush(drawn);
+   cairo_surface_flush(cached);
+
+   const int stride = cairo_image_surface_get_stride(drawn);
+   const unsigned char *a = cairo_image_surface_get_data(drawn);
+   const unsigned char *b = cairo_image_surface_get_data(cached);
+
+   int diffs = 0;
+   for (int y = 0; y < height; y++) {
+      const uint32_t *arow = (const uint32_t *)(a + y * stride);
+      const uint32_t *brow = (const uint32_t *)(b + y * stride);
+      for (int x = 0; x < width; x++) {
+         if (arow[x] != brow[x]) {
+            if (diffs == 0)
+               printf("%s%s %dx%d: first difference at %d,%d "
+                      "(%08x != %08x)\n",
+                      mode == COWMODE_NORMAL ? "say" : "think",
+                      left ? " left" : "", width, height, x, y,
+                      arow[x], brow[x]);
+            diffs++;
+         }
+      }
+   }
+
+   cairo_surface_destroy(drawn);
+   cairo_surface_destroy(cached);
+   return diffs;
+}
+
+int main(int argc, char **argv)
+{
+   const cowmode_t modes[] = { COWMODE_NORMAL, COWMODE_THINK };
+   int failed = 0, checked = 0;
+
+   for (int m = 0; m < 2; m++) {
+      for (int left = 0; left < 2; left++) {
+         // Go round twice so the second time comes from the cache
+         for (int pass = 0; pass < 2; pass++) {
+            for (int height = MIN_SIZE; height <= MAX_SIZE; height += 17) {
+               for (int width = MIN_SIZE; width <= MAX_SIZE; width += 13) {
+                  if (compare(width, height, modes[m], left) > 0)
+                     failed++;
+                  checked++;
+               }
+            }
+         }
+      }
+   }
+
+   printf("%d of %d bubbles differ\n", failed, checked);
+   return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
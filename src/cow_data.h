@@ -0,0 +1,32 @@
+/*  cow_data.h -- Stock cow images compiled into the program.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_COW_DATA_H
+#define INC_COW_DATA_H
+
+#include <glib.h>
+
+typedef struct {
+   const char *name;          // Image file name without the extension
+   int width, height;
+   const guint32 *pixels;     // Premultiplied ARGB with no row padding
+} cow_data_t;
+
+// Generated by mkcowdata and terminated by an entry with no name
+extern const cow_data_t cow_data[];
+
+#endif
@@ -0,0 +1,594 @@
+/*  daemon_client.c -- Send requests to a running xcowsay daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "daemon_client.h"
+
+static void discard_options(GVariant *options)
+{
+   if (options != NULL)
+      g_variant_unref(g_variant_ref_sink(options));
+}
+
+#ifndef WITH_DBUS
+
+GDBusConnection *daemon_connection(bool debug)
+{
+   return NULL;
+}
+
+bool daemon_running(bool debug, GDBusConnection *connection)
+{
+   return false;
+}
+
+bool daemon_absent(const GError *error)
+{
+   return true;
+}
+
+daemon_status_t daemon_show(bool debug, GDBusConnection *connection,
+                            const char *text, cowmode_t mode,
+                            GVariant *options, guint32 *id)
+{
+   discard_options(options);
+   return DAEMON_UNAVAILABLE;
+}
+
+daemon_status_t try_dbus(bool debug, const char *text, cowmode_t mode,
+                         GVariant *options, bool wait)
+{
+   debug_msg("Skipping DBus (disabled by configure)\n");
+   discard_options(options);
+   return DAEMON_UNAVAILABLE;
+}
+
+daemon_status_t daemon_show_batch(bool debug, GDBusConnection *connection,
+                                  char **texts, int count, cowmode_t mode,
+                                  GVariant *options, guint32 *ids)
+{
+   discard_options(options);
+   return DAEMON_UNAVAILABLE;
+}
+
+daemon_status_t try_dbus_batch(bool debug, char **texts, int count,
+                               cowmode_t mode, GVariant *options, bool wait)
+{
+   debug_msg("Skipping DBus (disabled by configure)\n");
+   discard_options(options);
+   return DAEMON_UNAVAILABLE;
+}
+
+daemon_waiter_t *daemon_wait_begin(bool debug, GDBusConnection *connection)
+{
+   return NULL;
+}
+
+bool daemon_wait_end(daemon_waiter_t *waiter, const guint32 *ids, int count)
+{
+   return false;
+}
+
+GSocketConnection *daemon_socket(bool debug)
+{
+   return NULL;
+}
+
+daemon_status_t socket_show(bool debug, GSocketConnection *connection,
+                            char **texts, int count, cowmode_t mode,
+                            GVariant *options, guint32 *ids)
+{
+   discard_options(options);
+   return DAEMON_UNAVAILABLE;
+}
+
+#else
+
+#include <gio/gunixsocketaddress.h>
+
+GDBusConnection *daemon_connection(bool debug)
+{
+   GError *error = NULL;
+   GDBusConnection *connection =
+      g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+   if (NULL == connection) {
+      debug_err("Failed to open connection to bus: %s\n", error->message);
+      g_error_free(error);
+      return NULL;
+   }
+
+   return connection;
+}
+
+bool daemon_running(bool debug, GDBusConnection *connection)
+{
+   GError *error = NULL;
+   GVariant *reply = g_dbus_connection_call_sync(
+      connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+      "org.freedesktop.DBus", "NameHasOwner",
+      g_variant_new("(s)", XCOWSAY_NAMESPACE), G_VARIANT_TYPE("(b)"),
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+   if (NULL == reply) {
+      debug_err("NameHasOwner failed: %s\n", error->message);
+      g_error_free(error);
+      return false;
+   }
+
+   gboolean has_owner;
+   g_variant_get(reply, "(b)", &has_owner);
+   g_variant_unref(reply);
+
+   debug_msg("Daemon is %srunning\n", has_owner ? "" : "not ");
+   return has_owner;
+}
+
+bool daemon_absent(const GError *error)
+{
+   return g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN)
+      || g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER);
+}
+
+static const char *mode_name(cowmode_t mode)
+{
+   switch (mode) {
+   case COWMODE_NORMAL:
+      return "say";
+   case COWMODE_THINK:
+      return "think";
+   case COWMODE_DREAM:
+      return "dream";
+   default:
+      g_assert_not_reached();
+   }
+}
+
+/*
+ * Errors in our own namespace mean the daemon is running but chose not
+ * to accept the request so the caller should not display it either.
+ */
+static daemon_status_t error_status(bool debug, const char *method,
+                                    GError *error)
+{
+   daemon_status_t status = DAEMON_UNAVAILABLE;
+
+   char *remote = g_dbus_error_get_remote_error(error);
+   if (remote != NULL
+       && g_str_has_prefix(remote, XCOWSAY_NAMESPACE ".Error.")) {
+      g_dbus_error_strip_remote_error(error);
+      g_printerr("xcowsay: %s\n", error->message);
+      status = DAEMON_REJECTED;
+   }
+   else if (daemon_absent(error)) {
+      debug_msg("Daemon is not running\n");
+      status = DAEMON_ABSENT;
+   }
+   else
+      debug_err("%s failed: %s\n", method, error->message);
+
+   g_free(remote);
+   g_error_free(error);
+   return status;
+}
+
+static GVariant *sink_options(GVariant *options)
+{
+   if (options == NULL)
+      options = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
+   return g_variant_ref_sink(options);
+}
+
+daemon_status_t daemon_show(bool debug, GDBusConnection *connection,
+                            const char *text, cowmode_t mode,
+                            GVariant *options, guint32 *id)
+{
+   options = sink_options(options);
+
+   GError *error = NULL;
+   GVariant *reply = g_dbus_connection_call_sync(
+      connection, XCOWSAY_NAMESPACE, XCOWSAY_PATH, XCOWSAY_NAMESPACE,
+      "Show", g_variant_new("(ss@a{sv})", mode_name(mode), text, options),
+      G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL,
+      &error);
+   g_variant_unref(options);
+   if (NULL == reply)
+      return error_status(debug, "Show", error);
+
+   guint32 reply_id;
+   g_variant_get(reply, "(u)", &reply_id);
+   g_variant_unref(reply);
+
+   debug_msg("Daemon queued request %u\n", reply_id);
+   if (id != NULL)
+      *id = reply_id;
+
+   return DAEMON_OK;
+}
+
+daemon_status_t daemon_show_batch(bool debug, GDBusConnection *connection,
+                                  char **texts, int count, cowmode_t mode,
+                                  GVariant *options, guint32 *ids)
+{
+   options = sink_options(options);
+
+   GVariantBuilder builder;
+   g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ssa{sv})"));
+   for (int i = 0; i < count; i++)
+      g_variant_builder_add(&builder, "(ss@a{sv})", mode_name(mode),
+                            texts[i], options);
+
+   g_variant_unref(options);
+
+   GError *error = NULL;
+   GVariant *reply = g_dbus_connection_call_sync(
+      connection, XCOWSAY_NAMESPACE, XCOWSAY_PATH, XCOWSAY_NAMESPACE,
+      "ShowBatch", g_variant_new("(a(ssa{sv}))", &builder),
+      G_VARIANT_TYPE("(au)"), G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL,
+      &error);
+   if (NULL == reply)
+      return error_status(debug, "ShowBatch", error);
+
+   GVariant *array = g_variant_get_child_value(reply, 0);
+   gsize n_ids;
+   const guint32 *reply_ids =
+      g_variant_get_fixed_array(array, &n_ids, sizeof(guint32));
+   g_assert(n_ids == count);
+
+   debug_msg("Daemon queued %d requests\n", count);
+   if (ids != NULL)
+      memcpy(ids, reply_ids, count * sizeof(guint32));
+
+   g_variant_unref(array);
+   g_variant_unref(reply);
+   return DAEMON_OK;
+}
+
+struct _daemon_waiter_t {
+   bool debug;
+   GDBusConnection *connection;
+   guint subscription;
+   guint watch;
+   GHashTable *dismissed;   // IDs of requests the daemon has finished
+   bool vanished;
+};
+
+static void on_dismissed(GDBusConnection *connection, const gchar *sender,
+                         const gchar *object_path, const gchar *interface,
+                         const gchar *signal, GVariant *parameters,
+                         gpointer user_data)
+{
+   daemon_waiter_t *waiter = (daemon_waiter_t*)user_data;
+   bool debug = waiter->debug;
+
+   if (!g_variant_is_of_type(parameters, G_VARIANT_TYPE("(us)")))
+      return;
+
+   guint32 id;
+   const gchar *reason;
+   g_variant_get(parameters, "(u&s)", &id, &reason);
+   debug_msg("Request %u dismissed (%s)\n", id, reason);
+
+   g_hash_table_add(waiter->dismissed, GUINT_TO_POINTER(id));
+}
+
+static void on_daemon_vanished(GDBusConnection *connection, const gchar *name,
+                               gpointer user_data)
+{
+   daemon_waiter_t *waiter = (daemon_waiter_t*)user_data;
+   bool debug = waiter->debug;
+
+   debug_msg("Daemon has gone away\n");
+   waiter->vanished = true;
+}
+
+daemon_waiter_t *daemon_wait_begin(bool debug, GDBusConnection *connection)
+{
+   daemon_waiter_t *waiter = g_new0(daemon_waiter_t, 1);
+   waiter->debug = debug;
+   waiter->connection = g_object_ref(connection);
+   waiter->dismissed = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+   waiter->subscription = g_dbus_connection_signal_subscribe(
+      connection, NULL, XCOWSAY_NAMESPACE, "Dismissed", XCOWSAY_PATH,
+      NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_dismissed, waiter, NULL);
+
+   waiter->watch = g_bus_watch_name_on_connection(
+      connection, XCOWSAY_NAMESPACE, G_BUS_NAME_WATCHER_FLAGS_NONE,
+      NULL, on_daemon_vanished, waiter, NULL);
+
+   return waiter;
+}
+
+bool daemon_wait_end(daemon_waiter_t *waiter, const guint32 *ids, int count)
+{
+   int done = 0;
+   while (done < count) {
+      if (g_hash_table_contains(waiter->dismissed, GUINT_TO_POINTER(ids[done])))
+         done++;
+      else if (waiter->vanished)
+         break;
+      else
+         g_main_context_iteration(NULL, TRUE);
+   }
+
+   g_bus_unwatch_name(waiter->watch);
+   g_dbus_connection_signal_unsubscribe(waiter->connection,
+                                        waiter->subscription);
+   g_hash_table_destroy(waiter->dismissed);
+   g_object_unref(waiter->connection);
+   g_free(waiter);
+
+   return done == count;
+}
+
+static daemon_status_t wait_for(bool debug, daemon_waiter_t *waiter,
+                                daemon_status_t status,
+                                const guint32 *ids, int count)
+{
+   if (waiter == NULL)
+      return status;
+   else if (status != DAEMON_OK) {
+      daemon_wait_end(waiter, NULL, 0);
+      return status;
+   }
+
+   debug_msg("Waiting for the daemon to dismiss %d request(s)\n", count);
+   if (!daemon_wait_end(waiter, ids, count)) {
+      g_printerr("xcowsay: daemon exited before the message was dismissed\n");
+      return DAEMON_LOST;
+   }
+
+   return DAEMON_OK;
+}
+
+char *daemon_socket_path(void)
+{
+   const char *path = g_getenv("XCOWSAY_SOCKET");
+   if (path != NULL && *path != '\0')
+      return g_strdup(path);
+   else
+      return g_build_filename(g_get_user_runtime_dir(), PACKAGE, "socket",
+                              NULL);
+}
+
+void frame_append(GByteArray *buf, GVariant *value)
+{
+   GVariant *le = g_variant_ref_sink(value);
+   if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+      le = g_variant_byteswap(value);
+      g_variant_unref(value);
+   }
+
+   const guint32 length = g_variant_get_size(le);
+   const guint32 header = GUINT32_TO_LE(length);
+   g_byte_array_append(buf, (const guint8 *)&header, sizeof(header));
+
+   const guint offset = buf->len;
+   g_byte_array_set_size(buf, offset + length);
+   g_variant_store(le, buf->data + offset);
+
+   g_variant_unref(le);
+}
+
+GVariant *frame_parse(const void *data, gsize length,
+                      const GVariantType *type)
+{
+   GBytes *bytes = g_bytes_new(data, length);
+   GVariant *value =
+      g_variant_ref_sink(g_variant_new_from_bytes(type, bytes, FALSE));
+   g_bytes_unref(bytes);
+
+   if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+      GVariant *native = g_variant_byteswap(value);
+      g_variant_unref(value);
+      value = native;
+   }
+
+   return value;
+}
+
+GSocketConnection *daemon_socket(bool debug)
+{
+   char *path = daemon_socket_path();
+   GSocketAddress *address = g_unix_socket_address_new(path);
+   GSocketClient *client = g_socket_client_new();
+
+   GError *error = NULL;
+   GSocketConnection *connection = g_socket_client_connect(
+      client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+   if (NULL == connection) {
+      debug_err("Failed to connect to %s: %s\n", path, error->message);
+      g_error_free(error);
+   }
+   else
+      debug_msg("Connected to %s\n", path);
+
+   g_object_unref(client);
+   g_object_unref(address);
+   g_free(path);
+   return connection;
+}
+
+static bool read_frame(GInputStream *in, GByteArray *buf, GError **error)
+{
+   guint32 header;
+   if (!g_input_stream_read_all(in, &header, sizeof(header), NULL, NULL,
+                                error))
+      return false;
+
+   const guint32 length = GUINT32_FROM_LE(header);
+   if (length > SOCKET_MAX_FRAME) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                  "Frame of %u bytes is too large", length);
+      return false;
+   }
+
+   gsize nread;
+   g_byte_array_set_size(buf, length);
+   if (!g_input_stream_read_all(in, buf->data, length, &nread, NULL, error))
+      return false;
+   else if (nread < length) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                  "Connection closed by the daemon");
+      return false;
+   }
+
+   return true;
+}
+
+#define SOCKET_WINDOW 256   // Requests sent before reading the replies
+
+/*
+ * Send the requests a window at a time so neither side blocks writing
+ * while the other is not reading.
+ */
+daemon_status_t socket_show(bool debug, GSocketConnection *connection,
+                            char **texts, int count, cowmode_t mode,
+                            GVariant *options, guint32 *ids)
+{
+   options = sink_options(options);
+
+   GOutputStream *out =
+      g_io_stream_get_output_stream(G_IO_STREAM(connection));
+   GInputStream *in = g_buffered_input_stream_new(
+      g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+
+   GByteArray *buf = g_byte_array_new();
+   daemon_status_t status = DAEMON_OK;
+   GError *error = NULL;
+
+   for (int sent = 0; sent < count && status == DAEMON_OK; ) {
+      const int n = MIN(count - sent, SOCKET_WINDOW);
+
+      g_byte_array_set_size(buf, 0);
+      for (int i = 0; i < n; i++)
+         frame_append(buf, g_variant_new("(ss@a{sv})", mode_name(mode),
+                                         texts[sent + i], options));
+
+      if (!g_output_stream_write_all(out, buf->data, buf->len, NULL,
+                                     NULL, &error)) {
+         status = DAEMON_UNAVAILABLE;
+         break;
+      }
+
+      for (int i = 0; i < n && status == DAEMON_OK; i++) {
+         if (!read_frame(in, buf, &error)) {
+            status = DAEMON_UNAVAILABLE;
+            break;
+         }
+
+         GVariant *reply = frame_parse(buf->data, buf->len,
+                                       G_VARIANT_TYPE("(uss)"));
+         guint32 id;
+         const gchar *name, *message;
+         g_variant_get(reply, "(u&s&s)", &id, &name, &message);
+
+         if (*name == '\0' && ids != NULL)
+            ids[sent + i] = id;
+         else if (g_str_has_prefix(name, XCOWSAY_NAMESPACE ".Error.")) {
+            g_printerr("xcowsay: %s\n", message);
+            status = DAEMON_REJECTED;
+         }
+         else if (*name != '\0') {
+            debug_err("Request failed: %s: %s\n", name, message);
+            status = DAEMON_UNAVAILABLE;
+         }
+
+         g_variant_unref(reply);
+      }
+
+      sent += n;
+   }
+
+   if (error != NULL) {
+      debug_err("Socket request failed: %s\n", error->message);
+      g_error_free(error);
+   }
+   else if (status == DAEMON_OK)
+      debug_msg("Daemon queued %d requests\n", count);
+
+   g_byte_array_unref(buf);
+   g_object_unref(in);
+   g_variant_unref(options);
+   return status;
+}
+
+// Used when there is no session bus at all
+static daemon_status_t try_socket(bool debug, char **texts, int count,
+                                  cowmode_t mode, GVariant *options,
+                                  bool wait)
+{
+   GSocketConnection *connection = daemon_socket(debug);
+   if (NULL == connection) {
+      discard_options(options);
+      return DAEMON_UNAVAILABLE;
+   }
+
+   if (wait)
+      debug_err("Cannot wait for the cow without a session bus\n");
+
+   daemon_status_t status =
+      socket_show(debug, connection, texts, count, mode, options, NULL);
+
+   g_object_unref(connection);
+   return status;
+}
+
+daemon_status_t try_dbus(bool debug, const char *text, cowmode_t mode,
+                         GVariant *options, bool wait)
+{
+   GDBusConnection *connection = daemon_connection(debug);
+   if (NULL == connection)
+      return try_socket(debug, (char **)&text, 1, mode, options, wait);
+
+   daemon_waiter_t *waiter = wait ? daemon_wait_begin(debug, connection) : NULL;
+
+   guint32 id;
+   daemon_status_t status =
+      daemon_show(debug, connection, text, mode, options, &id);
+   status = wait_for(debug, waiter, status, &id, 1);
+
+   g_object_unref(connection);
+   return status;
+}
+
+daemon_status_t try_dbus_batch(bool debug, char **texts, int count,
+                               cowmode_t mode, GVariant *options, bool wait)
+{
+   GDBusConnection *connection = daemon_connection(debug);
+   if (NULL == connection)
+      return try_socket(debug, texts, count, mode, options, wait);
+
+   daemon_waiter_t *waiter = wait ? daemon_wait_begin(debug, connection) : NULL;
+
+   guint32 *ids = g_new(guint32, count);
+   daemon_status_t status =
+      daemon_show_batch(debug, connection, texts, count, mode, options, ids);
+   status = wait_for(debug, waiter, status, ids, count);
+
+   g_free(ids);
+   g_object_unref(connection);
+   return status;
+}
+
+#endif /* #ifndef WITH_DBUS */
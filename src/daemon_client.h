@@ -0,0 +1,100 @@
+/*  daemon_client.h -- Send requests to a running xcowsay daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_DAEMON_CLIENT_H
+#define INC_DAEMON_CLIENT_H
+
+#include <stdbool.h>
+
+#include <gio/gio.h>
+
+#include "xcowsay.h"
+
+typedef enum {
+   DAEMON_OK,
+   DAEMON_UNAVAILABLE,
+   DAEMON_ABSENT,     // Nothing owns the daemon's name on the bus
+   DAEMON_REJECTED,   // The daemon is running but refused the request
+   DAEMON_LOST        // The daemon exited while we were waiting
+} daemon_status_t;
+
+// Collects Dismissed signals from the daemon
+typedef struct _daemon_waiter_t daemon_waiter_t;
+
+// Returns NULL if there is no session bus
+GDBusConnection *daemon_connection(bool debug);
+
+bool daemon_running(bool debug, GDBusConnection *connection);
+
+// True if a call failed because the daemon is not running.  Calls to
+// the daemon never start it so this is cheaper than daemon_running.
+bool daemon_absent(const GError *error);
+
+// The options dictionary may be NULL and is consumed if floating.  The
+// request ID is stored in *id unless it is NULL.
+daemon_status_t daemon_show(bool debug, GDBusConnection *connection,
+                            const char *text, cowmode_t mode,
+                            GVariant *options, guint32 *id);
+
+// Queue several messages with a single call
+daemon_status_t daemon_show_batch(bool debug, GDBusConnection *connection,
+                                  char **texts, int count, cowmode_t mode,
+                                  GVariant *options, guint32 *ids);
+
+// Start listening before sending the requests so no signal is missed
+daemon_waiter_t *daemon_wait_begin(bool debug, GDBusConnection *connection);
+
+// Block until every request in ids has been dismissed then free the
+// waiter.  Returns false if the daemon went away first.
+bool daemon_wait_end(daemon_waiter_t *waiter, const guint32 *ids, int count);
+
+/*
+ * The daemon can also listen on a Unix domain socket for clients
+ * without a session bus.  Each request is a frame holding a
+ * (mode, message, options) tuple of type (ssa{sv}) and the daemon
+ * answers each one in order with a frame of type (uss) holding the
+ * request ID, or zero and a DBus error name and message.  A frame is a
+ * 32-bit little-endian length followed by that many bytes of GVariant
+ * data in little-endian byte order.
+ */
+#define SOCKET_MAX_FRAME (1024 * 1024)
+
+// $XCOWSAY_SOCKET or a file in $XDG_RUNTIME_DIR.  Free with g_free.
+char *daemon_socket_path(void);
+
+// Append value to buf with its length in front
+void frame_append(GByteArray *buf, GVariant *value);
+
+// Decode the body of a frame.  The result is a new reference.
+GVariant *frame_parse(const void *data, gsize length,
+                      const GVariantType *type);
+
+// Returns NULL if nothing is listening on the socket
+GSocketConnection *daemon_socket(bool debug);
+
+daemon_status_t socket_show(bool debug, GSocketConnection *connection,
+                            char **texts, int count, cowmode_t mode,
+                            GVariant *options, guint32 *ids);
+
+// Pass the request to the daemon if there is one.  Without a session
+// bus these use the socket, which cannot wait for the cow.
+daemon_status_t try_dbus(bool debug, const char *text, cowmode_t mode,
+                         GVariant *options, bool wait);
+daemon_status_t try_dbus_batch(bool debug, char **texts, int count,
+                               cowmode_t mode, GVariant *options, bool wait);
+
+#endif
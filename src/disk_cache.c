@@ -0,0 +1,327 @@
+/*  disk_cache.c -- Share rendered bubbles between processes.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each bubble is a file named after a hash of its key holding a small
+ * header, the key itself to rule out collisions and then the pixels
+ * exactly as cairo lays them out, so loading one is just mmap.  Files
+ * are written under a temporary name and renamed into place so readers
+ * never see half a bubble and concurrent writers of the same bubble
+ * simply replace each other.  A hit updates the modification time and
+ * the least recently used files are deleted when the cache is full.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+
+#include "disk_cache.h"
+#include "xcowsay.h"
+
+#define CACHE_MAGIC   0x42574f43   // "COWB"
+#define CACHE_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304
+#define DATA_ALIGN    64
+#define SUFFIX        ".bubble"
+#define TEMP_PREFIX   ".tmp-"
+#define STALE_TEMP    3600   // Seconds before a temporary file is junk
+
+typedef struct {
+   guint32 magic;
+   guint32 version;
+   guint32 byte_order;       // Pixels are stored in native byte order
+   guint32 key_length;       // Bytes of key straight after the header
+   gint32 width, height;     // As returned by the renderer
+   gint32 surface_width, surface_height, stride;
+   guint32 data_offset;
+} cache_header_t;
+
+typedef struct {
+   void *map;
+   gsize size;
+} mapping_t;
+
+static const cairo_user_data_key_t mapping_key;
+
+static char *cache_dir(void)
+{
+   const char *cache = g_getenv("XDG_CACHE_HOME");
+   if (cache != NULL && g_path_is_absolute(cache))
+      return g_build_filename(cache, PACKAGE, NULL);
+   else
+      return g_build_filename(g_get_home_dir(), ".cache", PACKAGE, NULL);
+}
+
+// Bubbles drawn by another version may not look the same
+static char *full_key(const char *key)
+{
+   return g_strconcat(PACKAGE_VERSION, "\n", key, NULL);
+}
+
+static char *cache_path(const char *dir, const char *full)
+{
+   char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, full, -1);
+   char *name = g_strconcat(hash, SUFFIX, NULL);
+   char *path = g_build_filename(dir, name, NULL);
+   g_free(name);
+   g_free(hash);
+   return path;
+}
+
+static void unmap(void *data)
+{
+   mapping_t *m = data;
+   munmap(m->map, m->size);
+   g_free(m);
+}
+
+static bool header_valid(const cache_header_t *h, gsize size,
+                         const char *full)
+{
+   const gsize key_length = strlen(full);
+
+   if (h->magic != CACHE_MAGIC || h->version != CACHE_VERSION
+       || h->byte_order != BYTE_ORDER_MARK || h->key_length != key_length)
+      return false;
+   else if (h->surface_width <= 0 || h->surface_height <= 0
+            || h->stride != cairo_format_stride_for_width(
+                  CAIRO_FORMAT_ARGB32, h->surface_width))
+      return false;
+   else if (h->data_offset % DATA_ALIGN != 0
+            || h->data_offset < sizeof(cache_header_t) + key_length
+            || h->data_offset + (gsize)h->stride * h->surface_height > size)
+      return false;
+   else
+      return memcmp(h + 1, full, key_length) == 0;
+}
+
+cairo_surface_t *disk_cache_load(bool debug, const char *key, int *width,
+                                 int *height)
+{
+   char *dir = cache_dir();
+   char *full = full_key(key);
+   char *path = cache_path(dir, full);
+   g_free(dir);
+
+   cairo_surface_t *surface = NULL;
+   void *map = MAP_FAILED;
+   struct stat st;
+
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      goto out;
+
+   if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(cache_header_t))
+      goto out;
+
+   // Private so nothing drawn by mistake can reach the file
+   map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   if (MAP_FAILED == map)
+      goto out;
+
+   const cache_header_t *h = map;
+   if (!header_valid(h, st.st_size, full)) {
+      debug_msg("Ignoring bad cache file %s\n", path);
+      goto out;
+   }
+
+   surface = cairo_image_surface_create_for_data(
+      (unsigned char *)map + h->data_offset, CAIRO_FORMAT_ARGB32,
+      h->surface_width, h->surface_height, h->stride);
+   if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+      cairo_surface_destroy(surface);
+      surface = NULL;
+      goto out;
+   }
+
+   mapping_t *m = g_new(mapping_t, 1);
+   m->map = map;
+   m->size = st.st_size;
+   cairo_surface_set_user_data(surface, &mapping_key, m, unmap);
+   map = MAP_FAILED;
+
+   *width = h->width;
+   *height = h->height;
+
+   // Counts as a use when deciding what to evict
+   g_utime(path, NULL);
+
+   debug_msg("Loaded bubble from %s\n", path);
+
+ out:
+   if (map != MAP_FAILED)
+      munmap(map, st.st_size);
+   if (fd >= 0)
+      close(fd);
+   g_free(path);
+   g_free(full);
+   return surface;
+}
+
+static bool write_all(int fd, const void *buf, gsize len)
+{
+   const char *p = buf;
+   while (len > 0) {
+      const ssize_t n = write(fd, p, len);
+      if (n < 0 && errno == EINTR)
+         continue;
+      else if (n <= 0)
+         return false;
+
+      p += n;
+      len -= n;
+   }
+
+   return true;
+}
+
+typedef struct {
+   char *path;
+   gsize size;
+   time_t mtime;
+} cache_file_t;
+
+static gint compare_mtime(gconstpointer a, gconstpointer b)
+{
+   const cache_file_t *fa = a, *fb = b;
+   return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+// Delete the least recently used bubbles until the rest fit in budget
+static void evict(bool debug, const char *dir, gsize budget)
+{
+   GDir *d = g_dir_open(dir, 0, NULL);
+   if (NULL == d)
+      return;
+
+   GArray *files = g_array_new(FALSE, FALSE, sizeof(cache_file_t));
+   const time_t now = time(NULL);
+   gsize total = 0;
+
+   const char *name;
+   while ((name = g_dir_read_name(d)) != NULL) {
+      char *path = g_build_filename(dir, name, NULL);
+
+      GStatBuf st;
+      if (g_stat(path, &st) != 0)
+         g_free(path);
+      else if (g_str_has_prefix(name, TEMP_PREFIX)) {
+         // Left behind by a writer which died
+         if (now - st.st_mtime > STALE_TEMP)
+            g_unlink(path);
+         g_free(path);
+      }
+      else if (!g_str_has_suffix(name, SUFFIX))
+         g_free(path);
+      else {
+         cache_file_t f = { path, st.st_size, st.st_mtime };
+         g_array_append_val(files, f);
+         total += f.size;
+      }
+   }
+   g_dir_close(d);
+
+   g_array_sort(files, compare_mtime);
+
+   // Another process may be evicting too so a missing file is fine
+   for (guint i = 0; i < files->len && total > budget; i++) {
+      cache_file_t *f = &g_array_index(files, cache_file_t, i);
+      debug_msg("Evicting %s from the bubble cache\n", f->path);
+      g_unlink(f->path);
+      total -= f->size;
+   }
+
+   for (guint i = 0; i < files->len; i++)
+      g_free(g_array_index(files, cache_file_t, i).path);
+   g_array_free(files, TRUE);
+}
+
+void disk_cache_save(bool debug, const char *key, cairo_surface_t *surface,
+                     int width, int height, gsize budget)
+{
+   cairo_surface_flush(surface);
+
+   char *full = full_key(key);
+   const gsize key_length = strlen(full);
+
+   cache_header_t h = {
+      .magic = CACHE_MAGIC,
+      .version = CACHE_VERSION,
+      .byte_order = BYTE_ORDER_MARK,
+      .key_length = key_length,
+      .width = width,
+      .height = height,
+      .surface_width = cairo_image_surface_get_width(surface),
+      .surface_height = cairo_image_surface_get_height(surface),
+      .stride = cairo_image_surface_get_stride(surface),
+   };
+
+   const gsize key_end = sizeof(h) + key_length;
+   h.data_offset = (key_end + DATA_ALIGN - 1) & ~(DATA_ALIGN - 1);
+
+   const gsize data_size = (gsize)h.stride * h.surface_height;
+   if (h.data_offset + data_size > budget) {
+      g_free(full);
+      return;
+   }
+
+   char *dir = cache_dir();
+   g_mkdir_with_parents(dir, 0700);
+
+   char *path = cache_path(dir, full);
+   char *temp = g_build_filename(dir, TEMP_PREFIX "XXXXXX", NULL);
+
+   int fd = g_mkstemp(temp);
+   if (fd < 0) {
+      debug_msg("Cannot create %s: %s\n", temp, g_strerror(errno));
+      goto out;
+   }
+
+   static const char padding[DATA_ALIGN];
+   const bool ok = write_all(fd, &h, sizeof(h))
+      && write_all(fd, full, key_length)
+      && write_all(fd, padding, h.data_offset - key_end)
+      && write_all(fd, cairo_image_surface_get_data(surface), data_size);
+
+   if (close(fd) != 0 || !ok || g_rename(temp, path) != 0) {
+      debug_msg("Cannot write %s: %s\n", path, g_strerror(errno));
+      g_unlink(temp);
+      goto out;
+   }
+
+   debug_msg("Saved bubble to %s\n", path);
+
+   evict(debug, dir, budget);
+
+ out:
+   g_free(temp);
+   g_free(path);
+   g_free(dir);
+   g_free(full);
+}
@@ -0,0 +1,36 @@
+/*  disk_cache.h -- Share rendered bubbles between processes.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_DISK_CACHE_H
+#define INC_DISK_CACHE_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+// Returns a surface backed by the mapped file or NULL if the bubble
+// for key has not been saved.  The surface must not be drawn on.
+cairo_surface_t *disk_cache_load(bool debug, const char *key, int *width,
+                                 int *height);
+
+// Safe to call from any thread and from many processes at once.  The
+// oldest files are removed to keep the cache under budget bytes.
+void disk_cache_save(bool debug, const char *key, cairo_surface_t *surface,
+                     int width, int height, gsize budget);
+
+#endif
@@ -25,43 +25,87 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
 
 #include <gtk/gtk.h>
 
-#ifdef WITH_DBUS
-#include <dbus/dbus-glib-bindings.h>
-#define XCOWSAY_PATH "/uk/me/doof/Cowsay"
-#define XCOWSAY_NAMESPACE "uk.me.doof.Cowsay"
-#endif
-
 #include "floating_shape.h"
 #include "display_cow.h"
+#include "daemon_client.h"
+#include "bubblegen.h"
+#include "bubble_cache.h"
+#include "disk_cache.h"
+#include "cow_data.h"
 #include "settings.h"
 #include "i18n.h"
 
-GdkPixbuf *make_text_bubble(char *text, int *p_width, int *p_height,
-                            int max_width, cowmode_t mode);
-GdkPixbuf *make_dream_bubble(const char *file, int *p_width, int *p_height);
-
 #define TICK_TIMEOUT   100
 
+// Covers the scripts whose fallback fonts are slowest to find
+#define WARM_UP_TEXT \
+   "<b>Moo!</b> <i>Ünïcödé</i> Ελληνικά Кириллица עברית السلام عليكم " \
+   "हिन्दी ไทย 中文 日本語 한국어"
+
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
 typedef enum {
    csLeadIn, csDisplay, csLeadOut, csCleanup
 } cowstate_t;
 
+// Makes sure each worker thread takes exactly one warm up job
+typedef struct {
+   GMutex lock;
+   GCond cond;
+   int waiting, finished;
+} warm_up_t;
+
+/*
+ * A bubble rendered by a worker thread.  The reference count is only
+ * changed on the GTK thread and the results are not looked at until
+ * bubble_ready has run there.
+ */
+struct _prepared_cow_t {
+   int ref_count;
+   gint cancelled;          // Set atomically if nobody wants it
+   bool debug;
+   char *text;
+   cowmode_t mode;
+   char *cow_path;          // Image the bubble was sized against
+   int monitor;
+   int max_width;
+   bubble_params_t params;
+   char *cache_key;         // NULL if the bubble is not cached
+   gsize disk_budget;       // Worker saves the bubble to disk if set
+   bool done;
+   cairo_surface_t *surface;   // NULL if there was an error
+   int width, height;
+   GError *error;
+   warm_up_t *warm_up;      // Not displayed if set
+};
+
 typedef struct {
    float_shape_t *cow, *bubble;
    int bubble_width, bubble_height;
-   GdkPixbuf *cow_pixbuf, *bubble_pixbuf;
+   cairo_surface_t *cow_surface, *bubble_surface;
    cowstate_t state;
    int transition_timeout;
    int display_time;
    int screen_width, screen_height;
+   cow_complete_t complete;
+   gpointer complete_data;
+   dismiss_reason_t reason;
+   char *cow_path;
+   GdkRectangle geom;             // Monitor the cow is displayed on
+   prepared_cow_t *rendering;     // Bubble to display once it is ready
+   bool dismissed;                // Dismissed before it was displayed
+   bool debug;
+   gint64 cleanup_time;           // When the last cow went away
+   gint64 gap_start;              // Or zero if nothing was waiting
+   gint64 requested;              // When the request arrived or zero
 } xcowsay_t;
 
 static xcowsay_t xcowsay;
+static GThreadPool *render_pool = NULL;
 
 static gboolean tick(gpointer data);
 
@@ -80,7 +124,7 @@ static cowstate_t next_state(cowstate_t state)
    }
 }
 
-static GdkPixbuf *load_cow()
+static char *cow_image_path(void)
 {
    char *cow_path;
    const char *alt_image = get_string_option("alt_image");
@@ -92,19 +136,131 @@ static GdkPixbuf *load_cow()
          get_string_option("image_base"),
          get_string_option("cow_size"));
 
-   GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(cow_path, NULL);
-   if (NULL == pixbuf) {
+   return cow_path;
+}
+
+static gsize disk_budget(void)
+{
+   return (gsize)MAX(get_int_option("disk_cache"), 0) * 1024;
+}
+
+// The stock images are compiled in so the default cow appears without
+// reading or decoding any files
+static cairo_surface_t *embedded_cow(void)
+{
+   if (*get_string_option("alt_image"))
+      return NULL;
+
+   char *name = g_strdup_printf("%s_%s", get_string_option("image_base"),
+                                get_string_option("cow_size"));
+
+   cairo_surface_t *surface = NULL;
+   for (const cow_data_t *c = cow_data; c->name != NULL; c++) {
+      if (strcmp(c->name, name) == 0) {
+         // Never drawn on so it is safe to point cairo at read only data
+         surface = cairo_image_surface_create_for_data(
+            (unsigned char *)c->pixels, CAIRO_FORMAT_ARGB32,
+            c->width, c->height, c->width * 4);
+         break;
+      }
+   }
+
+   g_free(name);
+   return surface;
+}
+
+// Identifies the contents of an image file in the disk cache
+static char *image_key(const char *path)
+{
+   struct stat st;
+   if (0 == disk_budget() || stat(path, &st) != 0)
+      return NULL;
+
+   // The inode and size catch most changes within the same second
+   char *real = realpath(path, NULL);
+   char *key = g_strdup_printf("image\n%s\n%lld\n%llu\n%lld",
+                               real ? real : path, (long long)st.st_mtime,
+                               (unsigned long long)st.st_ino,
+                               (long long)st.st_size);
+   free(real);
+   return key;
+}
+
+// Decoded images are kept in the disk cache if it is enabled
+static cairo_surface_t *load_cow_file(bool debug, const char *path)
+{
+   char *key = image_key(path);
+   int width, height;
+
+   cairo_surface_t *surface =
+      key ? disk_cache_load(debug, key, &width, &height) : NULL;
+   if (surface != NULL) {
+      g_free(key);
+      return surface;
+   }
+
+   GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+   if (pixbuf != NULL) {
+      // Convert once here rather than every time the window is drawn
+      surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1, NULL);
+      g_object_unref(pixbuf);
+
+      if (key != NULL)
+         disk_cache_save(debug, key, surface,
+                         cairo_image_surface_get_width(surface),
+                         cairo_image_surface_get_height(surface),
+                         disk_budget());
+   }
+
+   g_free(key);
+   return surface;
+}
+
+/*
+ * Load the cow image for the current settings unless it is already
+ * loaded.  Failing to load the first image is fatal but afterwards the
+ * daemon keeps using the previous image.
+ */
+static void load_cow(bool debug)
+{
+   char *cow_path = cow_image_path();
+   if (xcowsay.cow_path != NULL && strcmp(cow_path, xcowsay.cow_path) == 0) {
+      free(cow_path);
+      return;
+   }
+
+   cairo_surface_t *surface = embedded_cow();
+   if (surface != NULL) {
+      debug_msg("Using built in image for %s\n", cow_path);
+   }
+   else
+      surface = load_cow_file(debug, cow_path);
+
+   if (NULL == surface) {
       fprintf(stderr, i18n("Failed to load cow image: %s\n"), cow_path);
-      exit(EXIT_FAILURE);
+      if (NULL == xcowsay.cow_surface)
+         exit(EXIT_FAILURE);
+      free(cow_path);
+      return;
    }
 
-   free(cow_path);
-   return pixbuf;
+   if (xcowsay.cow_surface != NULL)
+      cairo_surface_destroy(xcowsay.cow_surface);
+   free(xcowsay.cow_path);
+
+   xcowsay.cow_surface = surface;
+   xcowsay.cow_path = cow_path;
+}
+
+static int cow_image_width(void)
+{
+   return cairo_image_surface_get_width(xcowsay.cow_surface);
 }
 
 static gboolean cow_clicked(GtkWidget *widget, GdkEventButton *event, gpointer data)
 {
    if (csDisplay == xcowsay.state) {
+      xcowsay.reason = DISMISS_CLICKED;
       xcowsay.transition_timeout = 0;
       tick(NULL);
    }
@@ -148,7 +304,14 @@ static gboolean tick(gpointer data)
          xcowsay.cow = NULL;
          destroy_shape(xcowsay.bubble);
          xcowsay.bubble = NULL;
-         break;
+
+         // The callback may start displaying another cow straight away
+         // which installs a new timeout so stop this one regardless
+         xcowsay.cleanup_time = g_get_monotonic_time();
+         if (xcowsay.complete != NULL)
+            (*xcowsay.complete)(xcowsay.reason, xcowsay.complete_data);
+         xcowsay.cleanup_time = 0;
+         return false;
       }
    }
 
@@ -164,8 +327,11 @@ void cowsay_init(int *argc, char ***argv)
 
    xcowsay.cow = NULL;
    xcowsay.bubble = NULL;
-   xcowsay.bubble_pixbuf = NULL;
-   xcowsay.cow_pixbuf = load_cow();
+   xcowsay.bubble_surface = NULL;
+   xcowsay.cow_surface = NULL;
+   xcowsay.cow_path = NULL;
+   xcowsay.rendering = NULL;
+   load_cow(xcowsay.debug);
 }
 
 static int count_words(const char *s)
@@ -183,15 +349,22 @@ static int count_words(const char *s)
    return words;
 }
 
-static void normal_setup(const char *text, bool debug, cowmode_t mode)
+// Copy of the text without any trailing newline
+static char *trim_text(const char *text)
 {
    char *text_copy = strdup(text);
 
-   // Trim any trailing newline
    size_t len = strlen(text_copy);
-   if ('\n' == text_copy[len-1])
+   if (len > 0 && '\n' == text_copy[len-1])
       text_copy[len-1] = '\0';
 
+   return text_copy;
+}
+
+static void normal_display_time(const char *text, bool debug)
+{
+   char *text_copy = trim_text(text);
+
    // Count the words and work out the display time, if necessary
    xcowsay.display_time = get_int_option("display_time");
    if (xcowsay.display_time < 0) {
@@ -219,66 +392,489 @@ static void normal_setup(const char *text, bool debug, cowmode_t mode)
       debug_msg("Display time too long: clamped to %d\n", max_display);
    }
 
-   const int cow_width = shape_width(xcowsay.cow);
-   const int max_width = xcowsay.screen_width - cow_width;
-
-   if (xcowsay.bubble_pixbuf != NULL)
-      g_object_unref(xcowsay.bubble_pixbuf);
-
-   xcowsay.bubble_pixbuf = make_text_bubble(
-      text_copy, &xcowsay.bubble_width, &xcowsay.bubble_height,
-      max_width, mode);
    free(text_copy);
 }
 
-static void dream_setup(const char *file, bool debug)
+static void dream_display_time(void)
 {
-   debug_msg("Dreaming file: %s\n", file);
-
    xcowsay.display_time = get_int_option("display_time");
    if (xcowsay.display_time < 0)
       xcowsay.display_time = get_int_option("dream_time");
+}
+
+static void display_time_setup(const char *text, bool debug, cowmode_t mode)
+{
+   switch (mode) {
+   case COWMODE_NORMAL:
+   case COWMODE_THINK:
+      normal_display_time(text, debug);
+      break;
+   case COWMODE_DREAM:
+      dream_display_time();
+      break;
+   default:
+      fprintf(stderr, "Error: Unsupported cow mode %d\n", mode);
+      exit(1);
+   }
+}
 
-   if (xcowsay.bubble_pixbuf != NULL)
-      g_object_unref(xcowsay.bubble_pixbuf);
+// This is the slow part of displaying a cow and may run on any thread
+static cairo_surface_t *render_bubble(const char *text, bool debug, cowmode_t mode,
+                                int max_width, const bubble_params_t *params,
+                                int *width, int *height, GError **error)
+{
+   if (COWMODE_DREAM == mode) {
+      debug_msg("Dreaming file: %s\n", text);
+      return make_dream_bubble(text, width, height, params, error);
+   }
+   else {
+      char *text_copy = trim_text(text);
+      cairo_surface_t *surface =
+         make_text_bubble(text_copy, width, height, max_width, mode, params);
+      free(text_copy);
+      return surface;
+   }
+}
+
+// Returns NULL if the bubble should not be cached
+static char *cache_key(const char *text, cowmode_t mode, int max_width,
+                       const bubble_params_t *params)
+{
+   if (get_int_option("bubble_cache") <= 0
+       && get_int_option("disk_cache") <= 0)
+      return NULL;
 
-   xcowsay.bubble_pixbuf = make_dream_bubble(file, &xcowsay.bubble_width,
-                                             &xcowsay.bubble_height);
+   return bubble_cache_key(text, mode, max_width, params);
 }
 
-void display_cow(bool debug, const char *text, cowmode_t mode)
+static gsize cache_budget(void)
 {
-   GdkScreen *screen = gdk_screen_get_default();
+   return (gsize)MAX(get_int_option("bubble_cache"), 0) * 1024;
+}
+
+// Look in memory and then in the cache shared with other processes
+static cairo_surface_t *find_bubble(bool debug, const char *key,
+                                    int *width, int *height)
+{
+   cairo_surface_t *surface = bubble_cache_lookup(key, width, height);
+   if (surface != NULL || 0 == disk_budget())
+      return surface;
+
+   surface = disk_cache_load(debug, key, width, height);
+   if (surface != NULL)
+      bubble_cache_insert(key, surface, *width, *height, cache_budget());
+
+   return surface;
+}
+
+static void bubble_setup(const char *text, bool debug, cowmode_t mode)
+{
+   display_time_setup(text, debug, mode);
+
+   if (xcowsay.bubble_surface != NULL)
+      cairo_surface_destroy(xcowsay.bubble_surface);
+
+   const int cow_width = shape_width(xcowsay.cow);
+   const int max_width = xcowsay.screen_width - cow_width;
+
+   bubble_params_t params;
+   bubble_params_init(&params);
+
+   char *key = cache_key(text, mode, max_width, &params);
+   xcowsay.bubble_surface = key ? find_bubble(debug, key,
+                                              &xcowsay.bubble_width,
+                                              &xcowsay.bubble_height)
+      : NULL;
+
+   GError *error = NULL;
+   if (xcowsay.bubble_surface != NULL) {
+      debug_msg("Found bubble in cache\n");
+   }
+   else {
+      xcowsay.bubble_surface = render_bubble(text, debug, mode, max_width,
+                                             &params, &xcowsay.bubble_width,
+                                             &xcowsay.bubble_height, &error);
+      if (key != NULL && xcowsay.bubble_surface != NULL) {
+         bubble_cache_insert(key, xcowsay.bubble_surface,
+                             xcowsay.bubble_width, xcowsay.bubble_height,
+                             cache_budget());
+         if (disk_budget() > 0)
+            disk_cache_save(debug, key, xcowsay.bubble_surface,
+                            xcowsay.bubble_width, xcowsay.bubble_height,
+                            disk_budget());
+      }
+   }
+
+   g_free(key);
+   bubble_params_free(&params);
+
+   if (NULL == xcowsay.bubble_surface) {
+      fprintf(stderr, "Error: failed to load %s\n", text);
+      exit(1);
+   }
+}
 
+static int pick_monitor(GdkScreen *screen)
+{
    gint n_monitors = gdk_screen_get_n_monitors(screen);
 
    gint pick = get_int_option("monitor");
    if (pick < 0 || pick >= n_monitors)
       pick = random() % n_monitors;
 
+   return pick;
+}
+
+static void show_cow(void);
+
+// Called on the GTK thread once a worker has finished with the bubble
+static gboolean bubble_ready(gpointer data)
+{
+   prepared_cow_t *p = data;
+   p->done = true;
+
+   if (p->cache_key != NULL && p->surface != NULL)
+      bubble_cache_insert(p->cache_key, p->surface, p->width, p->height,
+                          cache_budget());
+
+   if (xcowsay.rendering == p)
+      show_cow();
+
+   free_prepared_cow(p);
+   return G_SOURCE_REMOVE;
+}
+
+static void warm_up_job(prepared_cow_t *p)
+{
+   warm_up_t *w = p->warm_up;
+   const bool debug = p->debug;
+
+   // Hold on to this thread until every other one has a job too
+   g_mutex_lock(&w->lock);
+   if (--(w->waiting) == 0)
+      g_cond_broadcast(&w->cond);
+   while (w->waiting > 0)
+      g_cond_wait(&w->cond, &w->lock);
+   g_mutex_unlock(&w->lock);
+
+   const gint64 start = g_get_monotonic_time();
+   p->surface = render_bubble(p->text, debug, p->mode, p->max_width,
+                              &p->params, &p->width, &p->height, &p->error);
+   debug_msg("Warmed up render thread in %.1fms\n",
+             (g_get_monotonic_time() - start) / 1000.0);
+
+   g_mutex_lock(&w->lock);
+   w->finished++;
+   g_cond_broadcast(&w->cond);
+   g_mutex_unlock(&w->lock);
+}
+
+static void render_job(gpointer data, gpointer user_data)
+{
+   prepared_cow_t *p = data;
+   const bool debug = p->debug;
+
+   if (p->warm_up != NULL) {
+      warm_up_job(p);
+      return;
+   }
+
+   // Nobody wants this bubble any more
+   if (g_atomic_int_get(&p->cancelled)) {
+      g_idle_add(bubble_ready, p);
+      return;
+   }
+
+   const gint64 start = g_get_monotonic_time();
+   p->surface = render_bubble(p->text, debug, p->mode, p->max_width,
+                              &p->params, &p->width, &p->height, &p->error);
+   debug_msg("Rendered bubble in %.1fms\n",
+             (g_get_monotonic_time() - start) / 1000.0);
+
+   if (p->disk_budget > 0 && p->surface != NULL)
+      disk_cache_save(debug, p->cache_key, p->surface, p->width, p->height,
+                      p->disk_budget);
+
+   g_idle_add(bubble_ready, p);
+}
+
+static GThreadPool *get_render_pool(void)
+{
+   if (NULL == render_pool) {
+      render_pool = g_thread_pool_new(render_job, NULL,
+                                      g_get_num_processors(), TRUE, NULL);
+      g_assert(render_pool);
+   }
+
+   return render_pool;
+}
+
+static prepared_cow_t *new_prepared(bool debug, const char *text,
+                                    cowmode_t mode, const char *cow_path,
+                                    int monitor, int max_width)
+{
+   prepared_cow_t *p = g_new0(prepared_cow_t, 1);
+   p->ref_count = 1;
+   p->debug = debug;
+   p->text = g_strdup(text);
+   p->mode = mode;
+   p->cow_path = strdup(cow_path);
+   p->monitor = monitor;
+   p->max_width = max_width;
+   bubble_params_init(&p->params);
+
+   return p;
+}
+
+// Skip the render if the same bubble was drawn recently
+static bool find_cached(prepared_cow_t *p)
+{
+   p->cache_key = cache_key(p->text, p->mode, p->max_width, &p->params);
+   if (NULL == p->cache_key)
+      return false;
+
+   p->surface = find_bubble(p->debug, p->cache_key, &p->width, &p->height);
+   if (NULL == p->surface) {
+      p->disk_budget = disk_budget();
+      return false;
+   }
+
+   const bool debug = p->debug;
+   debug_msg("Found bubble in cache\n");
+
+   p->done = true;
+   return true;
+}
+
+// The worker holds a reference until bubble_ready runs
+static prepared_cow_t *start_render(bool debug, const char *text,
+                                    cowmode_t mode, const char *cow_path,
+                                    int monitor, int max_width)
+{
+   prepared_cow_t *p =
+      new_prepared(debug, text, mode, cow_path, monitor, max_width);
+   if (find_cached(p))
+      return p;
+
+   p->ref_count++;
+
+   g_thread_pool_push(get_render_pool(), p, NULL);
+   return p;
+}
+
+void warm_up_bubbles(bool debug)
+{
+   const gint64 start = g_get_monotonic_time();
+
+   GdkScreen *screen = gdk_screen_get_default();
+   GdkRectangle geom;
+   gdk_screen_get_monitor_geometry(screen, 0, &geom);
+
+   const int max_width = geom.width - cow_image_width();
+
+   // The GTK thread still renders bubbles when the text is replaced
+   bubble_params_t params;
+   bubble_params_init(&params);
+   int width, height;
+   cairo_surface_destroy(make_text_bubble(WARM_UP_TEXT, &width, &height,
+                                          max_width, COWMODE_NORMAL,
+                                          &params));
+   bubble_params_free(&params);
+
+   GThreadPool *pool = get_render_pool();
+   const int threads = g_thread_pool_get_max_threads(pool);
+
+   warm_up_t w;
+   g_mutex_init(&w.lock);
+   g_cond_init(&w.cond);
+   w.waiting = threads;
+   w.finished = 0;
+
+   prepared_cow_t **jobs = g_new(prepared_cow_t *, threads);
+   for (int i = 0; i < threads; i++) {
+      jobs[i] = new_prepared(debug, WARM_UP_TEXT, COWMODE_NORMAL,
+                             xcowsay.cow_path, 0, max_width);
+      jobs[i]->warm_up = &w;
+      g_thread_pool_push(pool, jobs[i], NULL);
+   }
+
+   g_mutex_lock(&w.lock);
+   while (w.finished < threads)
+      g_cond_wait(&w.cond, &w.lock);
+   g_mutex_unlock(&w.lock);
+
+   for (int i = 0; i < threads; i++)
+      free_prepared_cow(jobs[i]);
+   g_free(jobs);
+
+   g_mutex_clear(&w.lock);
+   g_cond_clear(&w.cond);
+
+   debug_msg("Warmed up %d render threads in %.1fms\n", threads,
+             (g_get_monotonic_time() - start) / 1000.0);
+}
+
+prepared_cow_t *prepare_cow(bool debug, const char *text, cowmode_t mode)
+{
+   // Changing the cow image now would pull it out from under the cow
+   // on screen so only prepare bubbles for the same image
+   char *cow_path = cow_image_path();
+   if (NULL == xcowsay.cow_path || strcmp(cow_path, xcowsay.cow_path) != 0) {
+      free(cow_path);
+      return NULL;
+   }
+
+   GdkScreen *screen = gdk_screen_get_default();
+   const int pick = pick_monitor(screen);
+
    GdkRectangle geom;
    gdk_screen_get_monitor_geometry(screen, pick, &geom);
 
-   xcowsay.screen_width = geom.width;
-   xcowsay.screen_height = geom.height;
+   const int max_width = geom.width - cow_image_width();
 
-   g_assert(xcowsay.cow_pixbuf);
-   xcowsay.cow = make_shape_from_pixbuf(xcowsay.cow_pixbuf);
+   prepared_cow_t *p =
+      start_render(debug, text, mode, cow_path, pick, max_width);
+   free(cow_path);
+   return p;
+}
 
-   switch (mode) {
-   case COWMODE_NORMAL:
-   case COWMODE_THINK:
-      normal_setup(text, debug, mode);
-      break;
-   case COWMODE_DREAM:
-      dream_setup(text, debug);
-      break;
-   default:
-      fprintf(stderr, "Error: Unsupported cow mode %d\n", mode);
+void free_prepared_cow(prepared_cow_t *p)
+{
+   if (NULL == p)
+      return;
+   else if (--(p->ref_count) > 0) {
+      // Let the worker skip it if it has not started yet
+      g_atomic_int_set(&p->cancelled, 1);
+      return;
+   }
+
+   g_free(p->text);
+   free(p->cow_path);
+   g_free(p->cache_key);
+   bubble_params_free(&p->params);
+   if (p->surface != NULL)
+      cairo_surface_destroy(p->surface);
+   if (p->error != NULL)
+      g_error_free(p->error);
+   g_free(p);
+}
+
+// Position the bubble relative to the cow
+static void place_bubble(void)
+{
+   int bx;
+   if (get_bool_option("left"))
+      bx = shape_x(xcowsay.cow) - xcowsay.bubble_width
+         + get_int_option("bubble_x");
+   else
+      bx = shape_x(xcowsay.cow) + shape_width(xcowsay.cow)
+         + get_int_option("bubble_x");
+
+   int by = shape_y(xcowsay.cow)
+      + (shape_height(xcowsay.cow) - shape_height(xcowsay.bubble))/2
+      + get_int_option("bubble_y");
+   move_shape(xcowsay.bubble, bx, by);
+}
+
+void display_cow(bool debug, const char *text, cowmode_t mode,
+                 cow_complete_t complete, gpointer data)
+{
+   display_prepared_cow(debug, text, mode, NULL, complete, data);
+}
+
+void display_prepared_cow(bool debug, const char *text, cowmode_t mode,
+                          prepared_cow_t *prepared, cow_complete_t complete,
+                          gpointer data)
+{
+   GdkScreen *screen = gdk_screen_get_default();
+
+   // Stay on the monitor the bubble was prepared for
+   gint pick;
+   if (prepared != NULL
+       && prepared->monitor < gdk_screen_get_n_monitors(screen))
+      pick = prepared->monitor;
+   else
+      pick = pick_monitor(screen);
+
+   gdk_screen_get_monitor_geometry(screen, pick, &xcowsay.geom);
+
+   xcowsay.screen_width = xcowsay.geom.width;
+   xcowsay.screen_height = xcowsay.geom.height;
+
+   // The daemon may be showing a cow with different settings
+   load_cow(debug);
+
+   const int max_width =
+      xcowsay.screen_width - cow_image_width();
+
+   // The bubble can only be used if nothing it depends on has changed
+   if (prepared != NULL
+       && prepared->mode == mode
+       && strcmp(prepared->text, text) == 0
+       && strcmp(prepared->cow_path, xcowsay.cow_path) == 0
+       && prepared->max_width == max_width) {
+      debug_msg("Using prepared bubble\n");
+   }
+   else {
+      free_prepared_cow(prepared);
+      prepared = start_render(debug, text, mode, xcowsay.cow_path,
+                              pick, max_width);
+   }
+
+   display_time_setup(text, debug, mode);
+
+   xcowsay.complete = complete;
+   xcowsay.complete_data = data;
+   xcowsay.reason = DISMISS_TIMEOUT;
+   xcowsay.dismissed = false;
+   xcowsay.debug = debug;
+   xcowsay.gap_start = xcowsay.cleanup_time;
+
+   // The cow appears once the bubble has been rendered
+   xcowsay.rendering = prepared;
+   if (prepared->done)
+      show_cow();
+}
+
+// Runs after draw_shape has painted the cow for the first time
+static gboolean cow_drawn(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+   const bool debug = xcowsay.debug;
+   debug_msg("Cow first drawn %.1fms after it was requested\n",
+             (g_get_monotonic_time() - xcowsay.requested) / 1000.0);
+
+   xcowsay.requested = 0;
+   g_signal_handlers_disconnect_by_func(widget, cow_drawn, data);
+   return FALSE;
+}
+
+void time_next_cow(gint64 requested)
+{
+   xcowsay.requested = requested;
+}
+
+static void show_cow(void)
+{
+   prepared_cow_t *p = xcowsay.rendering;
+   xcowsay.rendering = NULL;
+
+   if (NULL == p->surface) {
+      fprintf(stderr, "Error: failed to load %s\n", p->text);
       exit(1);
    }
 
-   xcowsay.bubble = make_shape_from_pixbuf(xcowsay.bubble_pixbuf);
+   if (xcowsay.bubble_surface != NULL)
+      cairo_surface_destroy(xcowsay.bubble_surface);
+
+   xcowsay.bubble_surface = p->surface;
+   xcowsay.bubble_width = p->width;
+   xcowsay.bubble_height = p->height;
+   p->surface = NULL;
+
+   free_prepared_cow(p);
+
+   xcowsay.cow = make_shape_from_surface(xcowsay.cow_surface);
+   xcowsay.bubble = make_shape_from_surface(xcowsay.bubble_surface);
 
    int total_width = shape_width(xcowsay.cow)
       + get_int_option("bubble_x")
@@ -309,101 +905,167 @@ void display_cow(bool debug, const char *text, cowmode_t mode)
    else if (cow_y >= area_h)
       cow_y = area_h - 1;
 
-   if (get_bool_option("left")) {
+   if (get_bool_option("left"))
       move_shape(xcowsay.cow,
-                 geom.x + cow_x + xcowsay.bubble_width,
-                 geom.y + bubble_off + cow_y);
-      show_shape(xcowsay.cow);
-
-      int bx = shape_x(xcowsay.cow) - xcowsay.bubble_width
-         + get_int_option("bubble_x");
-      int by = shape_y(xcowsay.cow)
-         + (shape_height(xcowsay.cow) - shape_height(xcowsay.bubble))/2
-         + get_int_option("bubble_y");
-      move_shape(xcowsay.bubble, bx, by);
-   }
-   else {
+                 xcowsay.geom.x + cow_x + xcowsay.bubble_width,
+                 xcowsay.geom.y + bubble_off + cow_y);
+   else
       move_shape(xcowsay.cow,
-                 geom.x + cow_x,
-                 geom.y + bubble_off + cow_y);
-      show_shape(xcowsay.cow);
+                 xcowsay.geom.x + cow_x,
+                 xcowsay.geom.y + bubble_off + cow_y);
 
-      int bx = shape_x(xcowsay.cow) + shape_width(xcowsay.cow)
-         + get_int_option("bubble_x");
-      int by = shape_y(xcowsay.cow)
-         + (shape_height(xcowsay.cow) - shape_height(xcowsay.bubble))/2
-         + get_int_option("bubble_y");
-      move_shape(xcowsay.bubble, bx, by);
+   if (xcowsay.requested != 0)
+      g_signal_connect(G_OBJECT(shape_window(xcowsay.cow)), "draw",
+                       G_CALLBACK(cow_drawn), NULL);
+
+   show_shape(xcowsay.cow);
+   place_bubble();
+
+   const bool debug = xcowsay.debug;
+   if (xcowsay.gap_start != 0) {
+      debug_msg("Cow displayed %.1fms after the last one\n",
+                (g_get_monotonic_time() - xcowsay.gap_start) / 1000.0);
    }
 
-   xcowsay.state = csLeadIn;
-   xcowsay.transition_timeout = get_int_option("lead_in_time");
+   if (xcowsay.dismissed) {
+      // Dismissed while the bubble was being rendered
+      xcowsay.state = csDisplay;
+      xcowsay.transition_timeout = 0;
+   }
+   else {
+      xcowsay.state = csLeadIn;
+      xcowsay.transition_timeout = get_int_option("lead_in_time");
+   }
    g_timeout_add(TICK_TIMEOUT, tick, NULL);
 
    close_when_clicked(xcowsay.cow);
 }
 
-#ifndef WITH_DBUS
-
-bool try_dbus(bool debug, const char *text, cowmode_t mode)
+bool update_cow(bool debug, const char *text, cowmode_t mode)
 {
-   debug_msg("Skipping DBus (disabled by configure)\n");
-   return false;
-}
+   if (xcowsay.rendering != NULL) {
+      debug_msg("Replacing text in bubble being rendered\n");
+
+      prepared_cow_t *old = xcowsay.rendering;
+      display_time_setup(text, debug, mode);
+      xcowsay.rendering = start_render(debug, text, mode, old->cow_path,
+                                       old->monitor, old->max_width);
+      free_prepared_cow(old);
+
+      // The new text may already be in the cache
+      if (xcowsay.rendering->done)
+         show_cow();
+      return true;
+   }
+   else if (NULL == xcowsay.cow)
+      return false;
+   else if (csLeadIn != xcowsay.state && csDisplay != xcowsay.state)
+      return false;   // Too late as the bubble has already gone
+
+   debug_msg("Replacing text in existing bubble\n");
 
-#else
+   // Swap the image in the existing window rather than make a new one
+   bubble_setup(text, debug, mode);
+   set_shape_surface(xcowsay.bubble, xcowsay.bubble_surface);
+   place_bubble();
 
-bool try_dbus(bool debug, const char *text, cowmode_t mode)
+   // Give the new text the full display time, which may have changed
+   display_time_setup(text, debug, mode);
+   if (csDisplay == xcowsay.state)
+      xcowsay.transition_timeout = xcowsay.display_time;
+
+   return true;
+}
+
+void dismiss_cow(dismiss_reason_t reason)
 {
-   DBusGConnection *connection;
-   GError *error;
-   DBusGProxy *proxy;
-
-   g_type_init();
-   error = NULL;
-   connection = dbus_g_bus_get(DBUS_BUS_SESSION, &error);
-   if (NULL == connection) {
-      debug_err("Failed to open connection to bus: %s\n", error->message);
-      g_error_free(error);
-      return false;
+   if (xcowsay.rendering != NULL) {
+      // Take it away again as soon as it appears
+      xcowsay.reason = reason;
+      xcowsay.dismissed = true;
+      return;
    }
+   else if (NULL == xcowsay.cow)
+      return;
+   else if (csLeadIn != xcowsay.state && csDisplay != xcowsay.state)
+      return;   // Already on its way out
+
+   // Skip straight to the lead out on the next tick
+   xcowsay.reason = reason;
+   xcowsay.state = csDisplay;
+   xcowsay.transition_timeout = 0;
+}
 
-   proxy = dbus_g_proxy_new_for_name(connection, XCOWSAY_NAMESPACE,
-                                     XCOWSAY_PATH, XCOWSAY_NAMESPACE);
-   g_assert(proxy);
+static void quit_when_complete(dismiss_reason_t reason, gpointer data)
+{
+   gtk_main_quit();
+}
 
-   const char *method = NULL;
-   switch (mode) {
-   case COWMODE_NORMAL:
-      method = "ShowCow";
-      break;
-   case COWMODE_THINK:
-      method = "Think";
+void display_cow_or_invoke_daemon(bool debug, const char *text, cowmode_t mode,
+                                  bool wait, int *argc, char ***argv)
+{
+   // GTK and the cow image are only needed if we have to display the
+   // cow ourselves so don't pay for them if the daemon takes the request
+   switch (try_dbus(debug, text, mode, modified_options(), wait)) {
+   case DAEMON_OK:
       break;
-   case COWMODE_DREAM:
-      method = "Dream";
+   case DAEMON_REJECTED:
+   case DAEMON_LOST:
+      exit(EXIT_FAILURE);
+   case DAEMON_UNAVAILABLE:
+   case DAEMON_ABSENT:
+      cowsay_init(argc, argv);
+      display_cow(debug, text, mode, quit_when_complete, NULL);
+      gtk_main();
       break;
-   default:
-      g_assert(false);
    }
+}
 
-   error = NULL;
-   if (!dbus_g_proxy_call(proxy, method, &error, G_TYPE_STRING, text,
-                          G_TYPE_INVALID, G_TYPE_INVALID)) {
-      debug_err("ShowCow failed: %s\n", error->message);
-      g_error_free(error);
-      return false;
-   }
+typedef struct {
+   bool debug;
+   char **texts;
+   int count, next;
+   cowmode_t mode;
+} cow_sequence_t;
 
-   return true;
-}
+static void display_next_in_sequence(dismiss_reason_t reason, gpointer data)
+{
+   cow_sequence_t *seq = (cow_sequence_t*)data;
+   bool debug = seq->debug;
 
-#endif /* #ifndef WITH_DBUS */
+   if (seq->next == seq->count)
+      gtk_main_quit();
+   else {
+      debug_msg("Displaying message %d of %d\n", seq->next + 1, seq->count);
+      display_cow(debug, seq->texts[seq->next++], seq->mode,
+                  display_next_in_sequence, seq);
+   }
+}
 
-void display_cow_or_invoke_daemon(bool debug, const char *text, cowmode_t mode)
+void display_cows_or_invoke_daemon(bool debug, char **texts, int count,
+                                   cowmode_t mode, bool wait,
+                                   int *argc, char ***argv)
 {
-   if (!try_dbus(debug, text, mode)) {
-      display_cow(debug, text, mode);
-      gtk_main();
+   if (count == 0)
+      return;
+
+   GVariant *options = modified_options();
+   switch (try_dbus_batch(debug, texts, count, mode, options, wait)) {
+   case DAEMON_OK:
+      break;
+   case DAEMON_REJECTED:
+   case DAEMON_LOST:
+      exit(EXIT_FAILURE);
+   case DAEMON_UNAVAILABLE:
+   case DAEMON_ABSENT:
+      {
+         cowsay_init(argc, argv);
+
+         // Show the messages one after the other in this process
+         cow_sequence_t seq = { debug, texts, count, 0, mode };
+         display_next_in_sequence(DISMISS_TIMEOUT, &seq);
+         gtk_main();
+      }
+      break;
    }
 }
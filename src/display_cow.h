@@ -22,20 +22,53 @@
 
 #include <gtk/gtk.h>
 
-#define CALCULATE_DISPLAY_TIME -1   // Work out display time from word count
+#include "xcowsay.h"
 
-#define debug_msg(...) if (debug) printf(__VA_ARGS__);
-#define debug_err(...) if (debug) g_printerr(__VA_ARGS__);
+#define CALCULATE_DISPLAY_TIME -1   // Work out display time from word count
 
-typedef enum {
-   COWMODE_NORMAL,
-   COWMODE_DREAM,
-   COWMODE_THINK,
-} cowmode_t;
+// Called from the main loop once the cow has gone away
+typedef void (*cow_complete_t)(dismiss_reason_t reason, gpointer data);
 
 // Show a cow with the given string and clean up afterwards
-void display_cow(bool debug, const char *text, cowmode_t mode);
-void display_cow_or_invoke_daemon(bool debug, const char *text, cowmode_t mode);
+void display_cow(bool debug, const char *text, cowmode_t mode,
+                 cow_complete_t complete, gpointer data);
+
+// A bubble rendered ahead of time so the cow can be shown sooner
+typedef struct _prepared_cow_t prepared_cow_t;
+
+// Render the bubble for a cow which will be displayed later using the
+// current settings.  Returns NULL if it cannot be prepared now.
+prepared_cow_t *prepare_cow(bool debug, const char *text, cowmode_t mode);
+void free_prepared_cow(prepared_cow_t *prepared);
+
+// As display_cow but uses the prepared bubble if it is still valid.
+// Takes ownership of prepared which may be NULL.
+void display_prepared_cow(bool debug, const char *text, cowmode_t mode,
+                          prepared_cow_t *prepared, cow_complete_t complete,
+                          gpointer data);
+
+// Lay out a sample bubble with the configured font on every thread
+// that renders bubbles so fonts are loaded before the first message
+void warm_up_bubbles(bool debug);
+
+// Change the text of the cow on screen, if any, without displaying a
+// new cow.  Returns false if there is no bubble that can be updated.
+bool update_cow(bool debug, const char *text, cowmode_t mode);
+
+// Log how long after requested, a g_get_monotonic_time value, the
+// next cow is first drawn on the screen
+void time_next_cow(gint64 requested);
+
+// Take the cow off the screen early
+void dismiss_cow(dismiss_reason_t reason);
+
+// If wait is set these do not return until the daemon has finished
+// with the messages as well
+void display_cow_or_invoke_daemon(bool debug, const char *text, cowmode_t mode,
+                                  bool wait, int *argc, char ***argv);
+void display_cows_or_invoke_daemon(bool debug, char **texts, int count,
+                                   cowmode_t mode, bool wait,
+                                   int *argc, char ***argv);
 void cowsay_init(int *argc, char ***argv);
 
 #endif
@@ -30,11 +30,6 @@ static float_shape_t *alloc_shape()
    return s;
 }
 
-static void quit_callback(GtkWidget *widget, gpointer data)
-{
-   gtk_main_quit();
-}
-
 static gboolean draw_shape(GtkWidget *widget, GdkEventExpose *event,
                            gpointer userdata)
 {
@@ -44,7 +39,8 @@ static gboolean draw_shape(GtkWidget *widget, GdkEventExpose *event,
    GdkWindow *root_win;
    GdkPixbuf *root_pb;
 
-   cr = gdk_cairo_create(gtk_widget_get_window(widget));
+   GdkWindow *window = gtk_widget_get_window(widget);
+   cr = gdk_cairo_create(window);
 
    cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.0);
 
@@ -64,7 +60,20 @@ static gboolean draw_shape(GtkWidget *widget, GdkEventExpose *event,
       g_object_unref(root_pb);
    }
 
-   gdk_cairo_set_source_pixbuf(cr, s->pixbuf, 0, 0);
+   // Copy the image once into a surface which matches the window so
+   // every expose after the first is a plain blit
+   if (NULL == s->similar) {
+      s->similar = gdk_window_create_similar_surface(
+         window, CAIRO_CONTENT_COLOR_ALPHA, s->width, s->height);
+
+      cairo_t *copy = cairo_create(s->similar);
+      cairo_set_operator(copy, CAIRO_OPERATOR_SOURCE);
+      cairo_set_source_surface(copy, s->surface, 0, 0);
+      cairo_paint(copy);
+      cairo_destroy(copy);
+   }
+
+   cairo_set_source_surface(cr, s->similar, 0, 0);
    cairo_paint(cr);
 
    cairo_destroy(cr);
@@ -82,7 +91,7 @@ static void screen_changed(GtkWidget *widget, GdkScreen *screen,
    gtk_widget_set_visual(widget, visual);
 }
 
-float_shape_t *make_shape_from_pixbuf(GdkPixbuf *pixbuf)
+float_shape_t *make_shape_from_surface(cairo_surface_t *surface)
 {
    float_shape_t *s;
    GdkScreen *screen;
@@ -91,9 +100,10 @@ float_shape_t *make_shape_from_pixbuf(GdkPixbuf *pixbuf)
    s = alloc_shape();
    s->x = 0;
    s->y = 0;
-   s->pixbuf = pixbuf;
-   s->width = gdk_pixbuf_get_width(pixbuf);
-   s->height = gdk_pixbuf_get_height(pixbuf);
+   s->surface = cairo_surface_reference(surface);
+   s->similar = NULL;
+   s->width = cairo_image_surface_get_width(surface);
+   s->height = cairo_image_surface_get_height(surface);
 
    s->window = gtk_window_new(GTK_WINDOW_POPUP);
    gtk_window_set_decorated(GTK_WINDOW(s->window), FALSE);
@@ -122,8 +132,6 @@ float_shape_t *make_shape_from_pixbuf(GdkPixbuf *pixbuf)
                     G_CALLBACK(draw_shape), s);
    g_signal_connect(G_OBJECT(s->window), "screen-changed",
                     G_CALLBACK(screen_changed), s);
-   g_signal_connect(G_OBJECT(s->window), "destroy",
-                    G_CALLBACK(quit_callback), NULL);
 
    return s;
 }
@@ -147,11 +155,35 @@ void move_shape(float_shape_t *shape, int x, int y)
    gtk_window_move(GTK_WINDOW(shape->window), shape->x, shape->y);
 }
 
+static void clear_surfaces(float_shape_t *shape)
+{
+   cairo_surface_destroy(shape->surface);
+   if (shape->similar != NULL)
+      cairo_surface_destroy(shape->similar);
+}
+
+void set_shape_surface(float_shape_t *shape, cairo_surface_t *surface)
+{
+   cairo_surface_reference(surface);
+   clear_surfaces(shape);
+
+   shape->surface = surface;
+   shape->similar = NULL;
+   shape->width = cairo_image_surface_get_width(surface);
+   shape->height = cairo_image_surface_get_height(surface);
+
+   gtk_widget_set_size_request(GTK_WIDGET(shape->window),
+                               shape->width, shape->height);
+   gtk_window_resize(GTK_WINDOW(shape->window), shape->width, shape->height);
+   gtk_widget_queue_draw(shape->window);
+}
+
 void destroy_shape(float_shape_t *shape)
 {
    g_assert(shape);
 
    gtk_widget_destroy(shape->window);
+   clear_surfaces(shape);
 
    free(shape);
 }
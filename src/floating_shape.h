@@ -26,17 +26,22 @@
  */
 typedef struct {
    GtkWidget *window;
-   GdkPixbuf *pixbuf;
+   cairo_surface_t *surface;   // Premultiplied ARGB image
+   cairo_surface_t *similar;   // Copy in the window's format or NULL
    int x, y, width, height;
    bool composited;
 } float_shape_t;
 
-float_shape_t *make_shape_from_pixbuf(GdkPixbuf *pixbuf);
+// The shape keeps its own reference to the surface
+float_shape_t *make_shape_from_surface(cairo_surface_t *surface);
 void move_shape(float_shape_t *shape, int x, int y);
 void show_shape(float_shape_t *shape);
 void hide_shape(float_shape_t *shape);
 void destroy_shape(float_shape_t *shape);
 
+// Change the image of an existing shape without recreating the window
+void set_shape_surface(float_shape_t *shape, cairo_surface_t *surface);
+
 #define shape_window(s) (s->window)
 #define shape_x(s) (s->x)
 #define shape_y(s) (s->y)
@@ -0,0 +1,244 @@
+/*  follow.c -- Display each record from standard input as it arrives.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Standard input is watched from the main loop so records can be sent
+ * on as soon as they are complete, as with "tail -f log | xcowsay
+ * --follow".  The destination is chosen once at the start: the daemon
+ * over DBus, the daemon's socket if there is no session bus, or else a
+ * queue of cows displayed by this process.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "follow.h"
+#include "display_cow.h"
+#include "daemon_client.h"
+#include "settings.h"
+
+#define READ_SIZE 4096   // Bytes to read each time input is ready
+
+typedef struct {
+   bool debug;
+   cowmode_t mode;
+   char separator;
+   int *argc;
+   char ***argv;
+   GMainLoop *loop;
+   GString *partial;              // Input after the last separator
+   bool eof;
+   GVariant *options;
+
+   GDBusConnection *bus;          // Set if the daemon is on the bus
+   GSocketConnection *socket;     // Or if it is listening on the socket
+   daemon_waiter_t *waiter;
+   GArray *ids;                   // Requests to wait for
+
+   bool local;                    // Otherwise display the cows ourselves
+   GQueue pending;
+   bool showing;
+   int queue_size;
+} follow_t;
+
+static void show_next(follow_t *f);
+
+static void maybe_quit(follow_t *f)
+{
+   if (f->eof && !f->showing)
+      g_main_loop_quit(f->loop);
+}
+
+static void cow_done(dismiss_reason_t reason, gpointer data)
+{
+   follow_t *f = data;
+   f->showing = false;
+   show_next(f);
+   maybe_quit(f);
+}
+
+static void show_next(follow_t *f)
+{
+   char *text = g_queue_pop_head(&f->pending);
+   if (NULL == text)
+      return;
+
+   f->showing = true;
+   display_cow(f->debug, text, f->mode, cow_done, f);
+   g_free(text);
+}
+
+static void go_local(follow_t *f)
+{
+   bool debug = f->debug;
+   debug_msg("Displaying messages in this process\n");
+
+   if (f->waiter != NULL) {
+      daemon_wait_end(f->waiter, NULL, 0);
+      f->waiter = NULL;
+   }
+
+   g_clear_object(&f->bus);
+   g_clear_object(&f->socket);
+
+   cowsay_init(f->argc, f->argv);
+   f->local = true;
+}
+
+static void send_record(follow_t *f, char *text)
+{
+   daemon_status_t status = DAEMON_UNAVAILABLE;
+   guint32 id;
+
+   if (f->bus != NULL)
+      status = daemon_show(f->debug, f->bus, text, f->mode, f->options,
+                           &id);
+   else if (f->socket != NULL)
+      status = socket_show(f->debug, f->socket, &text, 1, f->mode,
+                           f->options, &id);
+
+   if (DAEMON_OK == status) {
+      if (f->waiter != NULL)
+         g_array_append_val(f->ids, id);
+      return;
+   }
+   else if (DAEMON_REJECTED == status)
+      return;   // The daemon is still there so keep going
+
+   // Carry on without the daemon if it has gone away
+   if (!f->local)
+      go_local(f);
+
+   g_queue_push_tail(&f->pending, g_strdup(text));
+
+   // Do not let the backlog grow forever if input comes in too quickly
+   if (f->queue_size > 0
+       && g_queue_get_length(&f->pending) > (guint)f->queue_size) {
+      bool debug = f->debug;
+      debug_msg("Too many messages waiting: dropping the oldest\n");
+      g_free(g_queue_pop_head(&f->pending));
+   }
+
+   if (!f->showing)
+      show_next(f);
+}
+
+// Send every complete record in the buffer
+static void split_records(follow_t *f)
+{
+   char *start = f->partial->str, *end;
+   const char *limit = f->partial->str + f->partial->len;
+   while ((end = memchr(start, f->separator, limit - start)) != NULL) {
+      *end = '\0';
+      if (*start != '\0')
+         send_record(f, start);
+      start = end + 1;
+   }
+
+   g_string_erase(f->partial, 0, start - f->partial->str);
+}
+
+static gboolean input_ready(GIOChannel *source, GIOCondition condition,
+                            gpointer data)
+{
+   follow_t *f = data;
+
+   const gsize len = f->partial->len;
+   g_string_set_size(f->partial, len + READ_SIZE);
+
+   ssize_t n;
+   do {
+      n = read(STDIN_FILENO, f->partial->str + len, READ_SIZE);
+   } while (n < 0 && errno == EINTR);
+
+   g_string_set_size(f->partial, len + MAX(n, 0));
+
+   if (n > 0) {
+      split_records(f);
+      return G_SOURCE_CONTINUE;
+   }
+
+   if (n < 0)
+      perror("stdin");
+
+   // The last record does not need a separator
+   if (f->partial->len > 0)
+      send_record(f, f->partial->str);
+
+   f->eof = true;
+   maybe_quit(f);
+   return G_SOURCE_REMOVE;
+}
+
+void follow_stdin(bool debug, cowmode_t mode, char separator, bool wait,
+                  int *argc, char ***argv)
+{
+   follow_t f = {
+      .debug = debug,
+      .mode = mode,
+      .separator = separator,
+      .argc = argc,
+      .argv = argv,
+      .partial = g_string_new(NULL),
+      .options = g_variant_ref_sink(modified_options()),
+      .ids = g_array_new(FALSE, FALSE, sizeof(guint32)),
+      .queue_size = get_int_option("queue_size"),
+   };
+   g_queue_init(&f.pending);
+
+   f.bus = daemon_connection(debug);
+   if (f.bus != NULL && !daemon_running(debug, f.bus))
+      g_clear_object(&f.bus);
+   else if (NULL == f.bus)
+      f.socket = daemon_socket(debug);
+
+   if (NULL == f.bus && NULL == f.socket)
+      go_local(&f);
+   else if (wait && f.bus != NULL)
+      f.waiter = daemon_wait_begin(debug, f.bus);
+   else if (wait)
+      debug_err("Cannot wait for the cow without a session bus\n");
+
+   f.loop = g_main_loop_new(NULL, FALSE);
+
+   GIOChannel *channel = g_io_channel_unix_new(STDIN_FILENO);
+   g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR, input_ready, &f);
+   g_io_channel_unref(channel);
+
+   g_main_loop_run(f.loop);
+
+   if (f.waiter != NULL
+       && !daemon_wait_end(f.waiter, (guint32 *)f.ids->data, f.ids->len)) {
+      g_printerr("xcowsay: daemon exited before the messages were "
+                 "dismissed\n");
+      exit(EXIT_FAILURE);
+   }
+
+   g_main_loop_unref(f.loop);
+   g_clear_object(&f.bus);
+   g_clear_object(&f.socket);
+   g_array_free(f.ids, TRUE);
+   g_variant_unref(f.options);
+   g_string_free(f.partial, TRUE);
+}
@@ -0,0 +1,30 @@
+/*  follow.h -- Display each record from standard input as it arrives.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_FOLLOW_H
+#define INC_FOLLOW_H
+
+#include <stdbool.h>
+
+#include "xcowsay.h"
+
+// Show every record up to each separator as its own message until the
+// end of input.  The daemon or GTK is only set up once.
+void follow_stdin(bool debug, cowmode_t mode, char separator, bool wait,
+                  int *argc, char ***argv);
+
+#endif
@@ -0,0 +1,693 @@
+/*  journal.c -- Persistent record of the daemon's pending requests.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The journal is an append-only file mapped into memory.  Each request
+ * is written when it is queued and a completion record is written when
+ * it goes away, so appending is just a memcpy.  The kernel writes the
+ * pages back on its own which survives the daemon being killed, and a
+ * timer asks a worker thread to fdatasync the file once a second if
+ * anything changed.  When most of the file is dead records a worker
+ * thread copies the live ones to a new file.  Records written while it
+ * runs are copied across before the new file replaces the old one.
+ *
+ * On start up the old journal is renamed out of the way and its live
+ * records replayed into a fresh one.  If the daemon dies during replay
+ * the renamed file is still there and is replayed again next time.
+ * A lock file stops a second daemon doing this to a journal which is
+ * still in use.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef WITH_DBUS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "journal.h"
+#include "xcowsay.h"
+
+#define JOURNAL_MAGIC   0x574f4358   // "XCOW"
+#define JOURNAL_VERSION 1
+
+#define INITIAL_SIZE  (64 * 1024)
+#define COMPACT_MIN   (64 * 1024)   // Do not bother compacting below this
+#define SYNC_INTERVAL 1             // Seconds between calls to fdatasync
+
+#define RECORD_ALIGN 8
+
+typedef struct {
+   guint32 magic;
+   guint32 version;
+} file_header_t;
+
+typedef enum {
+   RECORD_END,      // Unused space at the end of the file is zero
+   RECORD_QUEUED,
+   RECORD_DONE
+} record_type_t;
+
+typedef struct {
+   guint32 type;
+   guint32 id;
+   guint32 length;     // Bytes of payload after the header
+   guint32 checksum;   // Of the fields above and the payload
+} record_header_t;
+
+#define record_size(length)                     \
+   (sizeof(record_header_t)                     \
+    + (((length) + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1)))
+
+typedef struct {
+   gsize from, to;      // Offset of a record in the old and new files
+} moved_t;
+
+typedef struct {
+   int old_fd;          // The worker's own descriptor for the old file
+   gsize old_used;      // Bytes of the old file when the copy started
+   GArray *moved;       // Live records in order of their old offset
+   char *tmp;
+   int fd;
+   char *map;           // NULL if the new file could not be written
+   gsize size;
+   gsize used;
+} compaction_t;
+
+static struct {
+   int fd;
+   int lock_fd;         // Held for as long as the journal is open
+   char *path;
+   char *map;
+   gsize size;          // Of the file and the mapping
+   gsize used;          // Bytes up to the end of the last record
+   gsize dead;          // Bytes which compaction would reclaim
+   GHashTable *live;    // Offset of the latest record for each ID
+   bool dirty;          // Written since the last fdatasync
+   guint sync_source;
+   guint compact_source;
+   compaction_t *compaction;   // Running on a worker thread
+} journal = { .fd = -1, .lock_fd = -1 };
+
+static bool debug = false;
+
+// FNV-1a is plenty to spot a torn write after a power cut
+static guint32 checksum(const record_header_t *h, const void *payload)
+{
+   guint32 hash = 2166136261u;
+   const guint32 fields[] = { h->type, h->id, h->length };
+
+   const unsigned char *p = (const unsigned char *)fields;
+   for (size_t i = 0; i < sizeof(fields); i++)
+      hash = (hash ^ p[i]) * 16777619u;
+
+   p = payload;
+   for (size_t i = 0; i < h->length; i++)
+      hash = (hash ^ p[i]) * 16777619u;
+
+   return hash;
+}
+
+static char *journal_dir(void)
+{
+   const char *state = g_getenv("XDG_STATE_HOME");
+   if (state != NULL && g_path_is_absolute(state))
+      return g_build_filename(state, PACKAGE, NULL);
+   else
+      return g_build_filename(g_get_home_dir(), ".local", "state",
+                              PACKAGE, NULL);
+}
+
+// Create a file of the given size and map it with the header written
+static char *create_file(const char *path, gsize size, int *fd)
+{
+   *fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+   if (*fd < 0) {
+      g_warning("Cannot create journal %s: %s", path, g_strerror(errno));
+      return NULL;
+   }
+
+   char *map = MAP_FAILED;
+   if (ftruncate(*fd, size) == 0)
+      map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+
+   if (MAP_FAILED == map) {
+      g_warning("Cannot map journal %s: %s", path, g_strerror(errno));
+      close(*fd);
+      *fd = -1;
+      return NULL;
+   }
+
+   file_header_t *header = (file_header_t *)map;
+   header->magic = JOURNAL_MAGIC;
+   header->version = JOURNAL_VERSION;
+
+   return map;
+}
+
+// Double the size of a file and its mapping until it holds needed bytes
+static bool grow_file(int fd, char **map, gsize *size, gsize needed)
+{
+   if (needed <= *size)
+      return true;
+
+   gsize new_size = *size;
+   while (new_size < needed)
+      new_size *= 2;
+
+   char *new_map = MAP_FAILED;
+   if (ftruncate(fd, new_size) == 0)
+      new_map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+
+   if (MAP_FAILED == new_map) {
+      g_warning("Cannot grow journal: %s", g_strerror(errno));
+      return false;
+   }
+
+   munmap(*map, *size);
+   *map = new_map;
+   *size = new_size;
+   return true;
+}
+
+// Make sure there is room for another record of the given size
+static bool reserve(gsize bytes)
+{
+   return grow_file(journal.fd, &journal.map, &journal.size,
+                    journal.used + bytes);
+}
+
+// Returns the offset of the new record or -1 on error
+static gssize write_record(record_type_t type, guint32 id, GVariant *payload)
+{
+   const gsize length = payload ? g_variant_get_size(payload) : 0;
+   if (!reserve(record_size(length)))
+      return -1;
+
+   const gsize offset = journal.used;
+   record_header_t *h = (record_header_t *)(journal.map + offset);
+
+   if (payload != NULL)
+      g_variant_store(payload, h + 1);
+
+   h->type = type;
+   h->id = id;
+   h->length = length;
+   h->checksum = checksum(h, h + 1);
+
+   journal.used += record_size(length);
+   journal.dirty = true;
+   return offset;
+}
+
+static gsize record_size_at(gsize offset)
+{
+   const record_header_t *h = (record_header_t *)(journal.map + offset);
+   return record_size(h->length);
+}
+
+static void sync_thread(GTask *task, gpointer source, gpointer data,
+                        GCancellable *cancellable)
+{
+   const int fd = GPOINTER_TO_INT(data);
+   fdatasync(fd);
+   close(fd);
+}
+
+static gboolean sync_journal(gpointer data)
+{
+   if (!journal.dirty)
+      return G_SOURCE_CONTINUE;
+
+   // The worker gets its own descriptor in case compaction closes ours
+   const int fd = dup(journal.fd);
+   if (fd < 0)
+      return G_SOURCE_CONTINUE;
+
+   journal.dirty = false;
+
+   GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+   g_task_set_task_data(task, GINT_TO_POINTER(fd), NULL);
+   g_task_run_in_thread(task, sync_thread);
+   g_object_unref(task);
+
+   return G_SOURCE_CONTINUE;
+}
+
+static gint compare_moved(gconstpointer a, gconstpointer b)
+{
+   const gsize x = ((const moved_t *)a)->from, y = ((const moved_t *)b)->from;
+   return (x > y) - (x < y);
+}
+
+static void free_compaction(gpointer data)
+{
+   compaction_t *c = data;
+
+   if (c->map != NULL)
+      munmap(c->map, c->size);
+   if (c->fd >= 0)
+      close(c->fd);
+   close(c->old_fd);
+
+   g_array_free(c->moved, TRUE);
+   g_free(c->tmp);
+   g_free(c);
+}
+
+// Copy the live records to a new file in their original order
+static void compact_thread(GTask *task, gpointer source, gpointer data,
+                           GCancellable *cancellable)
+{
+   compaction_t *c = data;
+
+   // The daemon may remap the old file as it grows so map it again here
+   char *old = mmap(NULL, c->old_used, PROT_READ, MAP_SHARED,
+                    c->old_fd, 0);
+   if (MAP_FAILED == old) {
+      g_warning("Cannot map journal: %s", g_strerror(errno));
+      return;
+   }
+
+   c->map = create_file(c->tmp, c->size, &c->fd);
+   if (NULL == c->map) {
+      munmap(old, c->old_used);
+      return;
+   }
+
+   c->used = sizeof(file_header_t);
+   for (guint i = 0; i < c->moved->len; i++) {
+      moved_t *m = &g_array_index(c->moved, moved_t, i);
+      const record_header_t *h = (record_header_t *)(old + m->from);
+      const gsize bytes = record_size(h->length);
+      memcpy(c->map + c->used, h, bytes);
+      m->to = c->used;
+      c->used += bytes;
+   }
+
+   munmap(old, c->old_used);
+
+   if (fdatasync(c->fd) != 0) {
+      g_warning("Cannot sync journal %s: %s", c->tmp, g_strerror(errno));
+      munmap(c->map, c->size);
+      c->map = NULL;
+   }
+}
+
+static void compact_done(GObject *source, GAsyncResult *result,
+                         gpointer data)
+{
+   compaction_t *c = g_task_get_task_data(G_TASK(result));
+
+   // The journal was closed while the worker was running
+   if (c != journal.compaction) {
+      g_unlink(c->tmp);
+      return;
+   }
+
+   journal.compaction = NULL;
+
+   if (NULL == c->map) {
+      g_unlink(c->tmp);
+      return;
+   }
+
+   // The records written since the copy started are not synced but
+   // neither are any others written in the last second.  Renaming
+   // after they are copied means a crash never loses them.
+   const gsize tail = journal.used - c->old_used;
+   if (!grow_file(c->fd, &c->map, &c->size, c->used + tail)) {
+      g_unlink(c->tmp);
+      return;
+   }
+
+   memcpy(c->map + c->used, journal.map + c->old_used, tail);
+
+   if (g_rename(c->tmp, journal.path) != 0) {
+      g_warning("Cannot replace journal: %s", g_strerror(errno));
+      g_unlink(c->tmp);
+      return;
+   }
+
+   debug_msg("Compacted journal from %zu to %zu bytes\n",
+             journal.used, c->used + tail);
+
+   gsize live = 0;
+   GHashTableIter iter;
+   gpointer value;
+   g_hash_table_iter_init(&iter, journal.live);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      gsize offset = GPOINTER_TO_SIZE(value);
+      if (offset >= c->old_used)
+         offset = offset - c->old_used + c->used;
+      else {
+         // Anything live now from before the copy was live then too
+         const moved_t key = { .from = offset };
+         const moved_t *m = bsearch(&key, c->moved->data, c->moved->len,
+                                    sizeof(moved_t), compare_moved);
+         g_assert(m != NULL);
+         offset = m->to;
+      }
+
+      const record_header_t *h = (record_header_t *)(c->map + offset);
+      live += record_size(h->length);
+      g_hash_table_iter_replace(&iter, GSIZE_TO_POINTER(offset));
+   }
+
+   munmap(journal.map, journal.size);
+   close(journal.fd);
+
+   journal.fd = c->fd;
+   journal.map = c->map;
+   journal.size = c->size;
+   journal.used = c->used + tail;
+   journal.dead = journal.used - sizeof(file_header_t) - live;
+   journal.dirty = tail > 0;
+
+   c->fd = -1;
+   c->map = NULL;
+}
+
+static gboolean compact_journal(gpointer data)
+{
+   journal.compact_source = 0;
+
+   const int fd = dup(journal.fd);
+   if (fd < 0)
+      return G_SOURCE_REMOVE;
+
+   compaction_t *c = g_new0(compaction_t, 1);
+   c->old_fd = fd;
+   c->old_used = journal.used;
+   c->fd = -1;
+   c->tmp = g_strconcat(journal.path, ".new", NULL);
+   c->moved = g_array_new(FALSE, FALSE, sizeof(moved_t));
+
+   gsize needed = sizeof(file_header_t);
+
+   GHashTableIter iter;
+   gpointer value;
+   g_hash_table_iter_init(&iter, journal.live);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      const moved_t m = { .from = GPOINTER_TO_SIZE(value) };
+      g_array_append_val(c->moved, m);
+      needed += record_size_at(m.from);
+   }
+   g_array_sort(c->moved, compare_moved);
+
+   c->size = INITIAL_SIZE;
+   while (c->size < needed * 2)
+      c->size *= 2;
+
+   journal.compaction = c;
+
+   GTask *task = g_task_new(NULL, NULL, compact_done, NULL);
+   g_task_set_task_data(task, c, free_compaction);
+   g_task_run_in_thread(task, compact_thread);
+   g_object_unref(task);
+
+   return G_SOURCE_REMOVE;
+}
+
+static void maybe_compact(void)
+{
+   if (journal.used >= COMPACT_MIN && journal.dead > journal.used / 2
+       && 0 == journal.compact_source && NULL == journal.compaction)
+      journal.compact_source = g_idle_add(compact_journal, NULL);
+}
+
+/*
+ * Read a whole journal and call replay for each request which was not
+ * completed.  Reading stops at the first damaged record.
+ */
+static void replay_file(const char *path, journal_replay_t replay,
+                        gpointer data)
+{
+   gchar *contents;
+   gsize length;
+   if (!g_file_get_contents(path, &contents, &length, NULL))
+      return;
+
+   const file_header_t *header = (file_header_t *)contents;
+   if (length < sizeof(file_header_t) || header->magic != JOURNAL_MAGIC
+       || header->version != JOURNAL_VERSION) {
+      g_warning("Ignoring journal %s with unknown format", path);
+      g_free(contents);
+      return;
+   }
+
+   GBytes *bytes = g_bytes_new_take(contents, length);
+
+   GPtrArray *records = g_ptr_array_new();
+   GHashTable *index = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+   gsize offset = sizeof(file_header_t);
+   while (offset + sizeof(record_header_t) <= length) {
+      const record_header_t *h = (record_header_t *)(contents + offset);
+      if (RECORD_END == h->type)
+         break;
+      else if (h->length > length - offset - sizeof(record_header_t)
+               || h->checksum != checksum(h, h + 1)) {
+         g_warning("Journal %s is damaged after %zu bytes", path, offset);
+         break;
+      }
+
+      gpointer key = GUINT_TO_POINTER(h->id), pos;
+      const bool found = g_hash_table_lookup_extended(index, key, NULL, &pos);
+      GVariant **slot =
+         found ? (GVariant **)&g_ptr_array_index(records,
+                                                 GPOINTER_TO_UINT(pos))
+         : NULL;
+
+      if (RECORD_QUEUED == h->type) {
+         GBytes *sub = g_bytes_new_from_bytes(
+            bytes, offset + sizeof(record_header_t), h->length);
+         GVariant *v = g_variant_new_from_bytes(G_VARIANT_TYPE_VARIANT,
+                                                sub, FALSE);
+         GVariant *record = g_variant_get_variant(v);
+         g_variant_unref(v);
+         g_bytes_unref(sub);
+
+         // A replacement keeps the place of the original
+         if (slot != NULL) {
+            if (*slot != NULL)
+               g_variant_unref(*slot);
+            *slot = record;
+         }
+         else {
+            g_hash_table_insert(index, key,
+                                GUINT_TO_POINTER(records->len));
+            g_ptr_array_add(records, record);
+         }
+      }
+      else if (RECORD_DONE == h->type && slot != NULL && *slot != NULL) {
+         g_variant_unref(*slot);
+         *slot = NULL;
+      }
+
+      offset += record_size(h->length);
+   }
+
+   int replayed = 0;
+   for (guint i = 0; i < records->len; i++) {
+      GVariant *record = g_ptr_array_index(records, i);
+      if (record != NULL) {
+         (*replay)(record, data);
+         g_variant_unref(record);
+         replayed++;
+      }
+   }
+
+   debug_msg("Replayed %d requests from %s\n", replayed, path);
+
+   g_hash_table_destroy(index);
+   g_ptr_array_free(records, TRUE);
+   g_bytes_unref(bytes);
+}
+
+// The lock goes away with the process however it exits
+static bool lock_journal(const char *dir)
+{
+   char *path = g_build_filename(dir, "lock", NULL);
+   journal.lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+   if (journal.lock_fd < 0) {
+      g_warning("Cannot create %s: %s", path, g_strerror(errno));
+      g_free(path);
+      return false;
+   }
+
+   if (flock(journal.lock_fd, LOCK_EX | LOCK_NB) != 0) {
+      if (EWOULDBLOCK == errno)
+         g_warning("Journal %s is in use by another daemon", dir);
+      else
+         g_warning("Cannot lock %s: %s", path, g_strerror(errno));
+      close(journal.lock_fd);
+      journal.lock_fd = -1;
+      g_free(path);
+      return false;
+   }
+
+   g_free(path);
+   return true;
+}
+
+static void unlock_journal(void)
+{
+   if (journal.lock_fd >= 0) {
+      close(journal.lock_fd);
+      journal.lock_fd = -1;
+   }
+}
+
+bool journal_open(bool debug_flag, journal_replay_t replay, gpointer data)
+{
+   debug = debug_flag;
+
+   char *dir = journal_dir();
+   if (g_mkdir_with_parents(dir, 0700) != 0) {
+      g_warning("Cannot create %s: %s", dir, g_strerror(errno));
+      g_free(dir);
+      return false;
+   }
+
+   if (!lock_journal(dir)) {
+      g_free(dir);
+      return false;
+   }
+
+   journal.path = g_build_filename(dir, "journal", NULL);
+   char *old = g_strconcat(journal.path, ".old", NULL);
+   g_free(dir);
+
+   // A journal.old file means the daemon died while replaying it
+   if (!g_file_test(old, G_FILE_TEST_EXISTS)
+       && g_rename(journal.path, old) != 0 && errno != ENOENT) {
+      g_warning("Cannot move journal %s: %s", journal.path,
+                g_strerror(errno));
+      g_free(old);
+      g_free(journal.path);
+      journal.path = NULL;
+      unlock_journal();
+      return false;
+   }
+
+   journal.map = create_file(journal.path, INITIAL_SIZE, &journal.fd);
+   if (NULL == journal.map) {
+      g_free(old);
+      g_free(journal.path);
+      journal.path = NULL;
+      unlock_journal();
+      return false;
+   }
+
+   journal.size = INITIAL_SIZE;
+   journal.used = sizeof(file_header_t);
+   journal.dead = 0;
+   journal.live = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+   debug_msg("Journal is %s\n", journal.path);
+
+   // Replayed requests are written to the new journal as they are queued
+   replay_file(old, replay, data);
+
+   fdatasync(journal.fd);
+   g_unlink(old);
+   g_free(old);
+
+   journal.dirty = false;
+   journal.sync_source = g_timeout_add_seconds(SYNC_INTERVAL,
+                                               sync_journal, NULL);
+   return true;
+}
+
+void journal_close(void)
+{
+   if (NULL == journal.map)
+      return;
+
+   g_source_remove(journal.sync_source);
+   if (journal.compact_source != 0)
+      g_source_remove(journal.compact_source);
+
+   munmap(journal.map, journal.size);
+
+   // Trim the unused space at the end and leave the rest for next time
+   if (ftruncate(journal.fd, journal.used) == 0)
+      fdatasync(journal.fd);
+   close(journal.fd);
+
+   g_hash_table_destroy(journal.live);
+   g_free(journal.path);
+   unlock_journal();
+
+   journal.fd = -1;
+   journal.map = NULL;
+   journal.path = NULL;
+   journal.live = NULL;
+   journal.compaction = NULL;   // Its new file is removed when it finishes
+   journal.sync_source = journal.compact_source = 0;
+}
+
+void journal_append(guint32 id, GVariant *record)
+{
+   GVariant *payload = g_variant_ref_sink(g_variant_new_variant(record));
+
+   const gssize offset =
+      (journal.map != NULL) ? write_record(RECORD_QUEUED, id, payload) : -1;
+   g_variant_unref(payload);
+
+   if (offset < 0)
+      return;
+
+   gpointer key = GUINT_TO_POINTER(id), old;
+   if (g_hash_table_lookup_extended(journal.live, key, NULL, &old))
+      journal.dead += record_size_at(GPOINTER_TO_SIZE(old));
+
+   g_hash_table_insert(journal.live, key, GSIZE_TO_POINTER(offset));
+   maybe_compact();
+}
+
+void journal_complete(guint32 id)
+{
+   gpointer key = GUINT_TO_POINTER(id), old;
+   if (NULL == journal.map
+       || !g_hash_table_lookup_extended(journal.live, key, NULL, &old))
+      return;
+
+   const gsize dead = record_size_at(GPOINTER_TO_SIZE(old));
+
+   if (write_record(RECORD_DONE, id, NULL) < 0)
+      return;
+
+   journal.dead += dead + record_size(0);
+   g_hash_table_remove(journal.live, key);
+   maybe_compact();
+}
+
+#endif /* #ifdef WITH_DBUS */
@@ -0,0 +1,41 @@
+/*  journal.h -- Persistent record of the daemon's pending requests.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_JOURNAL_H
+#define INC_JOURNAL_H
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+// Called with each record which was not completed before the last exit
+typedef void (*journal_replay_t)(GVariant *record, gpointer data);
+
+// Replays and then truncates the journal in the default location under
+// $XDG_STATE_HOME.  Returns false if the journal cannot be used,
+// including when another daemon has it open.
+bool journal_open(bool debug, journal_replay_t replay, gpointer data);
+void journal_close(void);
+
+// Record a request which is waiting or on screen.  A later record with
+// the same ID replaces the earlier one.
+void journal_append(guint32 id, GVariant *record);
+
+// The request has gone away and should not be replayed
+void journal_complete(guint32 id);
+
+#endif
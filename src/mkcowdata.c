@@ -0,0 +1,135 @@
+/*  mkcowdata.c -- Decode the stock cow images into C source.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Run at build time to turn each PNG on the command line into an array
+ * of pixels in the format of a cairo ARGB32 image surface, so xcowsay
+ * can show the stock cow without reading or decompressing anything.
+ * Pixels are written as 32-bit numbers so the output does not depend
+ * on the byte order of the machine it was generated on.
+ *
+ * Usage: mkcowdata FILE.png... > cow_data.c
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#define PER_LINE 6
+
+// Same rounding as gdk_cairo_surface_create_from_pixbuf
+static guint32 premultiply(guint32 c, guint32 a)
+{
+   const guint32 t = c * a + 0x80;
+   return ((t >> 8) + t) >> 8;
+}
+
+static char *image_name(const char *file)
+{
+   char *name = g_path_get_basename(file);
+   char *dot = strrchr(name, '.');
+   if (dot != NULL)
+      *dot = '\0';
+
+   for (char *p = name; *p; p++) {
+      if (!isalnum((unsigned char)*p))
+         *p = '_';
+   }
+
+   return name;
+}
+
+static void emit_pixels(const char *name, GdkPixbuf *pixbuf)
+{
+   const int width = gdk_pixbuf_get_width(pixbuf);
+   const int height = gdk_pixbuf_get_height(pixbuf);
+   const int channels = gdk_pixbuf_get_n_channels(pixbuf);
+   const int rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+   const bool alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+   const guchar *data = gdk_pixbuf_read_pixels(pixbuf);
+
+   printf("static const guint32 %s_pixels[] = {", name);
+
+   int n = 0;
+   for (int y = 0; y < height; y++) {
+      const guchar *row = data + y * rowstride;
+      for (int x = 0; x < width; x++) {
+         const guchar *p = row + x * channels;
+         const guint32 a = alpha ? p[3] : 0xff;
+         const guint32 argb = (a << 24)
+            | (premultiply(p[0], a) << 16)
+            | (premultiply(p[1], a) << 8)
+            | premultiply(p[2], a);
+
+         printf("%s0x%08x,", (n++ % PER_LINE) ? " " : "\n   ", argb);
+      }
+   }
+
+   printf("\n};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+   if (argc < 2) {
+      fprintf(stderr, "Usage: mkcowdata FILE.png...\n");
+      return EXIT_FAILURE;
+   }
+
+   GdkPixbuf **pixbufs = g_new(GdkPixbuf *, argc);
+   char **names = g_new(char *, argc);
+
+   printf("/* Generated by mkcowdata from the stock images: do not edit */\n"
+          "\n"
+          "#include \"cow_data.h\"\n"
+          "\n");
+
+   for (int i = 1; i < argc; i++) {
+      GError *error = NULL;
+      pixbufs[i] = gdk_pixbuf_new_from_file(argv[i], &error);
+      if (NULL == pixbufs[i]) {
+         fprintf(stderr, "mkcowdata: %s\n", error->message);
+         return EXIT_FAILURE;
+      }
+
+      names[i] = image_name(argv[i]);
+      emit_pixels(names[i], pixbufs[i]);
+   }
+
+   printf("const cow_data_t cow_data[] = {\n");
+   for (int i = 1; i < argc; i++) {
+      printf("   { \"%s\", %d, %d, %s_pixels },\n", names[i],
+             gdk_pixbuf_get_width(pixbufs[i]),
+             gdk_pixbuf_get_height(pixbufs[i]), names[i]);
+      g_object_unref(pixbufs[i]);
+      g_free(names[i]);
+   }
+   printf("   { NULL, 0, 0, NULL }\n"
+          "};\n");
+
+   g_free(pixbufs);
+   g_free(names);
+
+   return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
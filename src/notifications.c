@@ -0,0 +1,328 @@
+/*  notifications.c -- Desktop notification server for the daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Implements enough of the Desktop Notifications Specification for
+ * notify-send and libnotify clients to show up as cows.  Notifications
+ * go through the same queue as ordinary requests and share their IDs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef WITH_DBUS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "notifications.h"
+#include "request_queue.h"
+#include "xcowsayd.h"
+
+#define NOTIFY_NAME "org.freedesktop.Notifications"
+#define NOTIFY_PATH "/org/freedesktop/Notifications"
+
+#define SPEC_VERSION "1.2"
+
+// Reasons for the NotificationClosed signal
+#define CLOSED_EXPIRED   1
+#define CLOSED_DISMISSED 2
+#define CLOSED_CALL      3
+#define CLOSED_UNDEFINED 4
+
+static const char introspection_xml[] =
+   "<node>"
+   "  <interface name='" NOTIFY_NAME "'>"
+   "    <method name='GetCapabilities'>"
+   "      <arg type='as' name='capabilities' direction='out'/>"
+   "    </method>"
+   "    <method name='Notify'>"
+   "      <arg type='s' name='app_name' direction='in'/>"
+   "      <arg type='u' name='replaces_id' direction='in'/>"
+   "      <arg type='s' name='app_icon' direction='in'/>"
+   "      <arg type='s' name='summary' direction='in'/>"
+   "      <arg type='s' name='body' direction='in'/>"
+   "      <arg type='as' name='actions' direction='in'/>"
+   "      <arg type='a{sv}' name='hints' direction='in'/>"
+   "      <arg type='i' name='expire_timeout' direction='in'/>"
+   "      <arg type='u' name='id' direction='out'/>"
+   "    </method>"
+   "    <method name='CloseNotification'>"
+   "      <arg type='u' name='id' direction='in'/>"
+   "    </method>"
+   "    <method name='GetServerInformation'>"
+   "      <arg type='s' name='name' direction='out'/>"
+   "      <arg type='s' name='vendor' direction='out'/>"
+   "      <arg type='s' name='version' direction='out'/>"
+   "      <arg type='s' name='spec_version' direction='out'/>"
+   "    </method>"
+   "    <signal name='NotificationClosed'>"
+   "      <arg type='u' name='id'/>"
+   "      <arg type='u' name='reason'/>"
+   "    </signal>"
+   "    <signal name='ActionInvoked'>"
+   "      <arg type='u' name='id'/>"
+   "      <arg type='s' name='action_key'/>"
+   "    </signal>"
+   "  </interface>"
+   "</node>";
+
+static GDBusNodeInfo *introspection_data = NULL;
+static GDBusConnection *bus = NULL;
+static guint owner_id = 0;
+static GHashTable *active = NULL;   // IDs of requests that came from Notify
+static bool debug = false;
+
+/*
+ * The bubble text is Pango markup so escape everything the client sent
+ * as we do not advertise the body-markup capability.
+ */
+static char *notification_text(const char *summary, const char *body)
+{
+   char *esc_summary = g_markup_escape_text(summary, -1);
+   char *esc_body = g_markup_escape_text(body, -1);
+
+   char *text;
+   if (*summary && *body)
+      text = g_strdup_printf("<b>%s</b>\n%s", esc_summary, esc_body);
+   else if (*summary)
+      text = g_strdup(esc_summary);
+   else
+      text = g_strdup(esc_body);
+
+   g_free(esc_summary);
+   g_free(esc_body);
+   return text;
+}
+
+static void handle_notify(const gchar *sender, GVariant *parameters,
+                          GDBusMethodInvocation *invocation)
+{
+   const gchar *app_name, *app_icon, *summary, *body;
+   guint32 replaces_id;
+   gint32 expire_timeout;
+   GVariant *actions, *hints;
+   g_variant_get(parameters, "(&su&s&s&s@as@a{sv}i)", &app_name,
+                 &replaces_id, &app_icon, &summary, &body, &actions,
+                 &hints, &expire_timeout);
+
+   debug_msg("Notify from %s: %s (replaces %u, expires %d)\n",
+             app_name, summary, replaces_id, expire_timeout);
+
+   GVariantDict options;
+   g_variant_dict_init(&options, NULL);
+
+   // Each notification has its own ID which the client may close
+   g_variant_dict_insert(&options, "coalesce", "b", FALSE);
+
+   if (replaces_id != 0)
+      g_variant_dict_insert(&options, "replaces", "u", replaces_id);
+
+   // The urgency levels low, normal and critical match our priorities
+   guchar urgency;
+   if (g_variant_lookup(hints, "urgency", "y", &urgency)
+       && urgency < NUM_PRIORITIES)
+      g_variant_dict_insert(&options, "priority", "i", (gint32)urgency);
+
+   // Zero means never expire which is the same as display_time zero and
+   // a negative value leaves it up to us
+   if (expire_timeout == 0)
+      g_variant_dict_insert(&options, "display_time", "i", 0);
+   else if (expire_timeout > 0) {
+      g_variant_dict_insert(&options, "display_time", "i", expire_timeout);
+      g_variant_dict_insert(&options, "min_display_time", "i",
+                            expire_timeout);
+      g_variant_dict_insert(&options, "max_display_time", "i",
+                            expire_timeout);
+   }
+
+   char *text = notification_text(summary, body);
+
+   guint32 id;
+   GError *error = NULL;
+   if (daemon_submit(sender, text, COWMODE_NORMAL,
+                     g_variant_dict_end(&options), &id, &error)) {
+      g_hash_table_add(active, GUINT_TO_POINTER(id));
+      g_dbus_method_invocation_return_value(invocation,
+                                            g_variant_new("(u)", id));
+   }
+   else
+      g_dbus_method_invocation_take_error(invocation, error);
+
+   g_free(text);
+   g_variant_unref(actions);
+   g_variant_unref(hints);
+}
+
+static void redo_notify(GDBusMethodInvocation *invocation)
+{
+   handle_notify(g_dbus_method_invocation_get_sender(invocation),
+                 g_dbus_method_invocation_get_parameters(invocation),
+                 invocation);
+}
+
+static void handle_close(GVariant *parameters,
+                         GDBusMethodInvocation *invocation)
+{
+   guint32 id;
+   g_variant_get(parameters, "(u)", &id);
+   debug_msg("CloseNotification %u\n", id);
+
+   // Closing a notification which has already gone is not an error
+   if (g_hash_table_contains(active, GUINT_TO_POINTER(id)))
+      daemon_cancel(id);
+
+   g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static void handle_method_call(GDBusConnection *connection,
+                               const gchar *sender,
+                               const gchar *object_path,
+                               const gchar *interface_name,
+                               const gchar *method_name,
+                               GVariant *parameters,
+                               GDBusMethodInvocation *invocation,
+                               gpointer user_data)
+{
+   if (g_strcmp0(method_name, "Notify") == 0) {
+      if (!daemon_defer_call(invocation, redo_notify))
+         handle_notify(sender, parameters, invocation);
+   }
+   else if (g_strcmp0(method_name, "CloseNotification") == 0)
+      handle_close(parameters, invocation);
+   else if (g_strcmp0(method_name, "GetCapabilities") == 0) {
+      const gchar *caps[] = { "body", NULL };
+      g_dbus_method_invocation_return_value(
+         invocation, g_variant_new("(^as)", caps));
+   }
+   else if (g_strcmp0(method_name, "GetServerInformation") == 0)
+      g_dbus_method_invocation_return_value(
+         invocation, g_variant_new("(ssss)", PACKAGE_NAME, "xcowsay",
+                                   PACKAGE_VERSION, SPEC_VERSION));
+   else
+      g_dbus_method_invocation_return_error(
+         invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+         "Unknown method %s", method_name);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+   handle_method_call,
+   NULL,
+   NULL
+};
+
+static void on_bus_acquired(GDBusConnection *connection, const gchar *name,
+                            gpointer user_data)
+{
+   GError *error = NULL;
+   guint id = g_dbus_connection_register_object(
+      connection, NOTIFY_PATH, introspection_data->interfaces[0],
+      &interface_vtable, NULL, NULL, &error);
+   if (0 == id) {
+      g_warning("Unable to register notifications object: %s",
+                error->message);
+      g_error_free(error);
+      return;
+   }
+
+   bus = connection;
+}
+
+static void on_name_acquired(GDBusConnection *connection, const gchar *name,
+                             gpointer user_data)
+{
+   debug_msg("Acquired name %s\n", name);
+}
+
+// Not fatal as another notification daemon may be running
+static void on_name_lost(GDBusConnection *connection, const gchar *name,
+                         gpointer user_data)
+{
+   g_warning("Unable to register notification service %s", name);
+}
+
+void notifications_init(bool debug_flag)
+{
+   debug = debug_flag;
+
+   introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+   g_assert(introspection_data);
+
+   active = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+   owner_id = g_bus_own_name(G_BUS_TYPE_SESSION, NOTIFY_NAME,
+                             G_BUS_NAME_OWNER_FLAGS_REPLACE,
+                             on_bus_acquired, on_name_acquired,
+                             on_name_lost, NULL, NULL);
+}
+
+void notifications_shutdown(void)
+{
+   if (0 == owner_id)
+      return;
+
+   g_bus_unown_name(owner_id);
+   g_hash_table_destroy(active);
+   g_dbus_node_info_unref(introspection_data);
+
+   owner_id = 0;
+   active = NULL;
+   bus = NULL;
+}
+
+void notifications_dismissed(guint32 id, dismiss_reason_t reason)
+{
+   if (NULL == active || !g_hash_table_remove(active, GUINT_TO_POINTER(id)))
+      return;
+
+   guint32 closed;
+   switch (reason) {
+   case DISMISS_TIMEOUT:
+   case DISMISS_EXPIRED:
+      closed = CLOSED_EXPIRED;
+      break;
+   case DISMISS_CLICKED:
+      closed = CLOSED_DISMISSED;
+      break;
+   case DISMISS_CANCELLED:
+      closed = CLOSED_CALL;
+      break;
+   default:
+      closed = CLOSED_UNDEFINED;
+      break;
+   }
+
+   debug_msg("Notification %u closed (%u)\n", id, closed);
+
+   if (NULL == bus)
+      return;
+
+   GError *error = NULL;
+   if (!g_dbus_connection_emit_signal(bus, NULL, NOTIFY_PATH, NOTIFY_NAME,
+                                      "NotificationClosed",
+                                      g_variant_new("(uu)", id, closed),
+                                      &error)) {
+      g_warning("Failed to emit NotificationClosed: %s", error->message);
+      g_error_free(error);
+   }
+}
+
+#endif /* #ifdef WITH_DBUS */
@@ -0,0 +1,32 @@
+/*  notifications.h -- Desktop notification server for the daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_NOTIFICATIONS_H
+#define INC_NOTIFICATIONS_H
+
+#include <stdbool.h>
+
+#include "xcowsay.h"
+
+// Try to own org.freedesktop.Notifications on the session bus
+void notifications_init(bool debug);
+void notifications_shutdown(void);
+
+// Called by the daemon whenever any request goes away
+void notifications_dismissed(guint32 id, dismiss_reason_t reason);
+
+#endif
@@ -0,0 +1,410 @@
+/*  request_queue.c -- Bounded queue of requests for the daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "request_queue.h"
+
+static guint32 next_id = 1;
+
+bool parse_queue_policy(const char *str, queue_policy_t *policy)
+{
+   if (strcmp(str, "reject") == 0)
+      *policy = QUEUE_REJECT;
+   else if (strcmp(str, "drop-oldest") == 0)
+      *policy = QUEUE_DROP_OLDEST;
+   else if (strcmp(str, "drop-newest") == 0)
+      *policy = QUEUE_DROP_NEWEST;
+   else
+      return false;
+
+   return true;
+}
+
+static guint request_hash(gconstpointer key)
+{
+   const request_t *req = (const request_t*)key;
+   return g_str_hash(req->message) ^ (req->mode << 8) ^ req->priority
+      ^ settings_hash(req->settings, "ttl");
+}
+
+static gboolean request_key_equal(gconstpointer a, gconstpointer b)
+{
+   return request_equal((const request_t*)a, (const request_t*)b);
+}
+
+void queue_init(request_queue_t *q, int capacity, queue_policy_t policy,
+                bool coalesce)
+{
+   for (int i = 0; i < NUM_PRIORITIES; i++)
+      q->lists[i].head = q->lists[i].tail = NULL;
+   q->length = 0;
+   q->capacity = capacity;
+   q->policy = policy;
+
+   if (coalesce)
+      q->index = g_hash_table_new(request_hash, request_key_equal);
+   else
+      q->index = NULL;
+
+   q->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+   q->senders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+   q->vclock = 0;
+   q->retired = g_ptr_array_new_with_free_func(
+      (GDestroyNotify)g_hash_table_unref);
+}
+
+request_t *request_new(const char *message, cowmode_t mode,
+                       settings_t *settings)
+{
+   const size_t len = strlen(message);
+   request_t *req = (request_t*)malloc(sizeof(request_t) + len + 1);
+   g_assert(req);
+
+   req->next = req->prev = NULL;
+   req->id = next_id++;
+   req->replaces = 0;
+   req->priority = PRIORITY_NORMAL;
+   req->repeat = 1;
+   req->digested = 0;
+   req->coalesce = true;
+   req->sender = NULL;
+   req->vtime = 0;
+   req->mode = mode;
+   req->deadline = 0;
+
+   if (next_id == 0)
+      next_id = 1;   // Zero is never a valid ID
+
+   req->enqueued = g_get_monotonic_time();
+   req->settings = settings;
+   memcpy(req->message, message, len + 1);
+
+   return req;
+}
+
+void request_free(request_t *req)
+{
+   free_settings(req->settings);
+   g_free(req->sender);
+   free(req);
+}
+
+bool request_equal(const request_t *a, const request_t *b)
+{
+   // A merged request keeps the longer lifetime of the two
+   return a->mode == b->mode && a->priority == b->priority
+      && strcmp(a->message, b->message) == 0
+      && settings_equal(a->settings, b->settings, "ttl");
+}
+
+char *request_text(const request_t *req)
+{
+   // The message is a file name in dream mode
+   if (req->repeat > 1 && req->mode != COWMODE_DREAM)
+      return g_strdup_printf("%s\n(\u00d7%d)", req->message, req->repeat);
+   else
+      return g_strdup(req->message);
+}
+
+static void index_request(request_queue_t *q, request_t *req)
+{
+   if (q->index != NULL && req->coalesce
+       && !g_hash_table_contains(q->index, req))
+      g_hash_table_add(q->index, req);
+
+   g_hash_table_insert(q->ids, GUINT_TO_POINTER(req->id), req);
+}
+
+static void unindex_request(request_queue_t *q, request_t *req)
+{
+   // There may be an equal request which is not the one in the index
+   if (q->index != NULL && g_hash_table_lookup(q->index, req) == req)
+      g_hash_table_remove(q->index, req);
+
+   // Spliced requests are not in the table of their new queue
+   gpointer key = GUINT_TO_POINTER(req->id);
+   if (g_hash_table_lookup(q->ids, key) == req)
+      g_hash_table_remove(q->ids, key);
+}
+
+static void unlink_request(request_queue_t *q, request_t *req)
+{
+   unindex_request(q, req);
+
+   request_list_t *list = &(q->lists[req->priority]);
+
+   if (req->prev != NULL)
+      req->prev->next = req->next;
+   else
+      list->head = req->next;
+
+   if (req->next != NULL)
+      req->next->prev = req->prev;
+   else
+      list->tail = req->prev;
+
+   req->next = req->prev = NULL;
+   q->length--;
+}
+
+/*
+ * Start-time fair queuing with equal weights: a sender's next request
+ * is due one tick after its previous one, or one tick after the
+ * request being displayed if it has nothing waiting.
+ */
+static guint64 sender_vtime(request_queue_t *q, const char *sender)
+{
+   if (NULL == sender)
+      return q->vclock + 1;
+
+   guint64 *last = g_hash_table_lookup(q->senders, sender);
+   if (NULL == last) {
+      last = g_new(guint64, 1);
+      *last = q->vclock;
+      g_hash_table_insert(q->senders, g_strdup(sender), last);
+   }
+
+   *last = MAX(*last, q->vclock) + 1;
+   return *last;
+}
+
+static void insert_request(request_list_t *list, request_t *req)
+{
+   // The new request usually goes at the end so try that first
+   request_t *after = list->tail;
+   if (after != NULL && after->vtime > req->vtime) {
+      after = NULL;
+      for (request_t *it = list->head;
+           it != NULL && it->vtime <= req->vtime; it = it->next)
+         after = it;
+   }
+
+   req->prev = after;
+   if (after != NULL) {
+      req->next = after->next;
+      after->next = req;
+   }
+   else {
+      req->next = list->head;
+      list->head = req;
+   }
+
+   if (req->next != NULL)
+      req->next->prev = req;
+   else
+      list->tail = req;
+}
+
+// The request that would be dropped first when the queue is full
+static request_t *lowest_request(const request_queue_t *q)
+{
+   for (int i = 0; i < NUM_PRIORITIES; i++) {
+      if (q->lists[i].head != NULL)
+         return q->lists[i].head;
+   }
+   return NULL;
+}
+
+push_result_t queue_push(request_queue_t *q, request_t *req,
+                         request_t **evicted)
+{
+   *evicted = NULL;
+
+   g_assert(req->priority >= 0 && req->priority < NUM_PRIORITIES);
+
+   if (q->capacity > 0 && q->length >= q->capacity) {
+      request_t *lowest = lowest_request(q);
+      if (lowest != NULL && lowest->priority < req->priority) {
+         *evicted = lowest;
+         unlink_request(q, lowest);
+      }
+      else {
+         switch (q->policy) {
+         case QUEUE_REJECT:
+            return PUSH_REJECTED;
+         case QUEUE_DROP_NEWEST:
+            return PUSH_DROPPED;
+         case QUEUE_DROP_OLDEST:
+            if (NULL == lowest || lowest->priority > req->priority)
+               return PUSH_DROPPED;
+            *evicted = lowest;
+            unlink_request(q, lowest);
+            break;
+         }
+      }
+   }
+
+   req->vtime = sender_vtime(q, req->sender);
+   insert_request(&(q->lists[req->priority]), req);
+   q->length++;
+
+   index_request(q, req);
+
+   return PUSH_QUEUED;
+}
+
+request_t *queue_first(const request_queue_t *q)
+{
+   for (int i = NUM_PRIORITIES - 1; i >= 0; i--) {
+      if (q->lists[i].head != NULL)
+         return q->lists[i].head;
+   }
+   return NULL;
+}
+
+request_t *queue_next(const request_queue_t *q, const request_t *req)
+{
+   if (req->next != NULL)
+      return req->next;
+
+   for (int i = req->priority - 1; i >= 0; i--) {
+      if (q->lists[i].head != NULL)
+         return q->lists[i].head;
+   }
+   return NULL;
+}
+
+request_t *queue_pop(request_queue_t *q)
+{
+   request_t *req = queue_first(q);
+   if (NULL == req)
+      return NULL;
+
+   unlink_request(q, req);
+   q->vclock = MAX(q->vclock, req->vtime);
+
+   // Forget senders with nothing left in the queue
+   guint64 *last;
+   if (req->sender != NULL
+       && (last = g_hash_table_lookup(q->senders, req->sender)) != NULL
+       && *last <= q->vclock)
+      g_hash_table_remove(q->senders, req->sender);
+
+   return req;
+}
+
+void queue_splice(request_queue_t *dst, request_queue_t *src)
+{
+   for (int i = 0; i < NUM_PRIORITIES; i++) {
+      request_list_t *from = &(src->lists[i]), *to = &(dst->lists[i]);
+      if (NULL == from->head)
+         continue;
+
+      if (to->tail != NULL) {
+         to->tail->next = from->head;
+         from->head->prev = to->tail;
+      }
+      else
+         to->head = from->head;
+
+      to->tail = from->tail;
+      from->head = from->tail = NULL;
+   }
+
+   dst->length += src->length;
+   src->length = 0;
+
+   // Emptying the tables would take time proportional to their size
+   if (src->index != NULL) {
+      g_ptr_array_add(dst->retired, src->index);
+      src->index = g_hash_table_new(request_hash, request_key_equal);
+   }
+
+   g_ptr_array_add(dst->retired, src->ids);
+   src->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+   g_ptr_array_add(dst->retired, src->senders);
+   src->senders = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        g_free, g_free);
+}
+
+void queue_free_retired(request_queue_t *q)
+{
+   g_ptr_array_set_size(q->retired, 0);
+}
+
+void queue_remove(request_queue_t *q, request_t *req)
+{
+   unlink_request(q, req);
+}
+
+request_t *queue_find(request_queue_t *q, guint32 id)
+{
+   return g_hash_table_lookup(q->ids, GUINT_TO_POINTER(id));
+}
+
+request_t *queue_find_equal(request_queue_t *q, const request_t *req)
+{
+   if (NULL == q->index)
+      return NULL;
+   else
+      return (request_t*)g_hash_table_lookup(q->index, req);
+}
+
+void queue_replace(request_queue_t *q, request_t *old, request_t *req)
+{
+   request_list_t *list = &(q->lists[old->priority]);
+
+   unindex_request(q, old);
+
+   req->priority = old->priority;
+   req->vtime = old->vtime;
+   req->prev = old->prev;
+   req->next = old->next;
+
+   if (old->prev != NULL)
+      old->prev->next = req;
+   else
+      list->head = req;
+
+   if (old->next != NULL)
+      old->next->prev = req;
+   else
+      list->tail = req;
+
+   old->next = old->prev = NULL;
+
+   index_request(q, req);
+}
+
+static gboolean sender_idle(gpointer key, gpointer value, gpointer data)
+{
+   const request_queue_t *q = data;
+   return *(guint64 *)value <= q->vclock;
+}
+
+void queue_forget_idle_senders(request_queue_t *q)
+{
+   g_hash_table_foreach_remove(q->senders, sender_idle, q);
+}
+
+size_t queue_room(const request_queue_t *q)
+{
+   if (q->capacity <= 0)
+      return SIZE_MAX;
+   else if (q->length >= q->capacity)
+      return 0;
+   else
+      return q->capacity - q->length;
+}
@@ -0,0 +1,133 @@
+/*  request_queue.h -- Bounded queue of requests for the daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_REQUEST_QUEUE_H
+#define INC_REQUEST_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "xcowsay.h"
+#include "settings.h"
+
+#define PRIORITY_LOW      0
+#define PRIORITY_NORMAL   1
+#define PRIORITY_CRITICAL 2
+#define NUM_PRIORITIES    3
+
+typedef struct _request_t {
+   struct _request_t *next, *prev;
+   guint32 id;
+   guint32 replaces;       // ID of an earlier request to update or zero
+   int priority;
+   int repeat;             // Number of identical requests merged into this
+   int digested;           // Messages summarised if this is a digest
+   bool coalesce;          // May be merged with an identical request
+   char *sender;           // Client which sent the request or NULL
+   guint64 vtime;          // Virtual time used to take turns between senders
+   cowmode_t mode;
+   gint64 enqueued;
+   gint64 deadline;        // Drop if not displayed by this time or zero
+   settings_t *settings;   // NULL to use the daemon's settings
+   char message[];         // Allocated with the request
+} request_t;
+
+// What to do with a new request when the queue is full
+typedef enum {
+   QUEUE_REJECT, QUEUE_DROP_OLDEST, QUEUE_DROP_NEWEST
+} queue_policy_t;
+
+typedef enum {
+   PUSH_QUEUED, PUSH_REJECTED, PUSH_DROPPED
+} push_result_t;
+
+typedef struct {
+   request_t *head, *tail;
+} request_list_t;
+
+/*
+ * One list per priority level.  Each list is kept in order of virtual
+ * time so senders with requests waiting take turns rather than one busy
+ * client holding up everyone else.
+ */
+typedef struct {
+   request_list_t lists[NUM_PRIORITIES];
+   int length, capacity;
+   queue_policy_t policy;
+   GHashTable *index;     // Requests by mode and message if coalescing
+   GHashTable *ids;       // Requests by ID
+   GHashTable *senders;   // Virtual time of each sender's newest request
+   guint64 vclock;        // Virtual time of the last request popped
+   GPtrArray *retired;    // Tables taken from a spliced queue
+} request_queue_t;
+
+bool parse_queue_policy(const char *str, queue_policy_t *policy);
+void queue_init(request_queue_t *q, int capacity, queue_policy_t policy,
+                bool coalesce);
+
+// Takes ownership of the settings snapshot and assigns a new ID
+request_t *request_new(const char *message, cowmode_t mode,
+                       settings_t *settings);
+void request_free(request_t *req);
+
+// True if the requests would display the same thing
+bool request_equal(const request_t *a, const request_t *b);
+
+// Text to display including the repeat count.  Free with g_free.
+char *request_text(const request_t *req);
+
+// If an older request has to make way it is returned in *evicted.  A
+// full queue drops its oldest lowest priority request rather than
+// turn away one with a higher priority whatever the policy.
+push_result_t queue_push(request_queue_t *q, request_t *req,
+                         request_t **evicted);
+
+// Returns the next request with the highest priority.  Requests from
+// the same sender come out in the order they were pushed.
+request_t *queue_pop(request_queue_t *q);
+
+// Walk the requests in the order they will be displayed
+request_t *queue_first(const request_queue_t *q);
+request_t *queue_next(const request_queue_t *q, const request_t *req);
+
+// Move every request in src to the end of dst in constant time.  The
+// spliced requests cannot be found in dst and src gets empty tables:
+// the old ones are kept in dst until queue_free_retired.
+void queue_splice(request_queue_t *dst, request_queue_t *src);
+void queue_free_retired(request_queue_t *q);
+
+// Take a request out of the queue without freeing it
+void queue_remove(request_queue_t *q, request_t *req);
+
+// Look for a request which has not been displayed yet in constant time
+request_t *queue_find(request_queue_t *q, guint32 id);
+
+// Look for a queued request equal to req in constant time.  Always
+// returns NULL unless the queue was created with coalescing enabled.
+request_t *queue_find_equal(request_queue_t *q, const request_t *req);
+
+// Put a new request in the place of an old one which is not freed.
+// The new request inherits the priority of the old one.
+void queue_replace(request_queue_t *q, request_t *old, request_t *req);
+
+// Discard fair queuing state for clients with nothing waiting
+void queue_forget_idle_senders(request_queue_t *q);
+
+// Number of requests that can be pushed without hitting the limit
+size_t queue_room(const request_queue_t *q);
+
+#endif
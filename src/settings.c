@@ -38,6 +38,7 @@ typedef struct {
    option_type_t type;
    option_value_t u;
    const char *name;
+   bool modified;   // Changed from the built-in default
 } option_t;
 
 typedef struct _option_list_t {
@@ -46,6 +47,7 @@ typedef struct _option_list_t {
 } option_list_t;
 
 static option_list_t *options = NULL;
+static option_list_t *active = NULL;   // Overrides options if non-NULL
 
 static option_list_t *alloc_node()
 {
@@ -55,15 +57,24 @@ static option_list_t *alloc_node()
    return node;
 }
 
-static option_t *get_option(const char *name)
+static option_t *find_option(const char *name)
 {
    option_list_t *it;
-   for (it = options; it != NULL; it = it->next) {
+   for (it = (active ? active : options); it != NULL; it = it->next) {
       if (strcmp(name, it->opt.name) == 0)
          return &it->opt;
    }
-   fprintf(stderr, "Invalid option '%s'\n", name);
-   exit(EXIT_FAILURE);
+   return NULL;
+}
+
+static option_t *get_option(const char *name)
+{
+   option_t *opt = find_option(name);
+   if (opt == NULL) {
+      fprintf(stderr, "Invalid option '%s'\n", name);
+      exit(EXIT_FAILURE);
+   }
+   return opt;
 }
 
 
@@ -114,7 +125,7 @@ const char *get_string_option(const char *name)
 
 static void add_option(const char *name, option_type_t type, option_value_t def)
 {
-   option_t opt = { type, def, name };
+   option_t opt = { type, def, name, false };
    option_list_t *node = alloc_node();
    node->opt = opt;
    node->next = options;
@@ -147,6 +158,7 @@ void set_int_option(const char *name, int ival)
    option_t *opt = get_option(name);
    assert_int(opt);
    opt->u.ival = ival;
+   opt->modified = true;
 }
 
 void set_bool_option(const char *name, bool bval)
@@ -154,6 +166,7 @@ void set_bool_option(const char *name, bool bval)
    option_t *opt = get_option(name);
    assert_bool(opt);
    opt->u.bval = bval;
+   opt->modified = true;
 }
 
 void set_string_option(const char *name, const char *sval)
@@ -162,4 +175,151 @@ void set_string_option(const char *name, const char *sval)
    assert_string(opt);
    free(opt->u.sval);
    opt->u.sval = strdup(sval);
+   opt->modified = true;
+}
+
+settings_t *copy_settings(void)
+{
+   option_list_t *copy = NULL, **tail = &copy;
+   option_list_t *it;
+   for (it = (active ? active : options); it != NULL; it = it->next) {
+      option_list_t *node = alloc_node();
+      node->opt = it->opt;
+      if (optString == node->opt.type)
+         node->opt.u.sval = strdup(it->opt.u.sval);
+      *tail = node;
+      tail = &node->next;
+   }
+   return copy;
+}
+
+void free_settings(settings_t *settings)
+{
+   while (settings != NULL) {
+      option_list_t *next = settings->next;
+      if (optString == settings->opt.type)
+         free(settings->opt.u.sval);
+      free(settings);
+      settings = next;
+   }
+}
+
+static bool option_equal(const option_t *a, const option_t *b)
+{
+   if (a->type != b->type || strcmp(a->name, b->name) != 0)
+      return false;
+
+   switch (a->type) {
+   case optInt:
+      return a->u.ival == b->u.ival;
+   case optBool:
+      return a->u.bval == b->u.bval;
+   case optString:
+      return strcmp(a->u.sval, b->u.sval) == 0;
+   default:
+      return false;
+   }
+}
+
+bool settings_equal(const settings_t *a, const settings_t *b,
+                    const char *ignore)
+{
+   // Every snapshot is copied from the process-wide list so the
+   // options are always in the same order
+   const option_list_t *x = a ? a : options, *y = b ? b : options;
+   for (; x != NULL && y != NULL; x = x->next, y = y->next) {
+      if (ignore != NULL && strcmp(x->opt.name, ignore) == 0)
+         continue;
+      else if (!option_equal(&x->opt, &y->opt))
+         return false;
+   }
+
+   return x == NULL && y == NULL;
+}
+
+guint settings_hash(const settings_t *settings, const char *ignore)
+{
+   guint hash = 0;
+   const option_list_t *it;
+   for (it = settings ? settings : options; it != NULL; it = it->next) {
+      if (ignore != NULL && strcmp(it->opt.name, ignore) == 0)
+         continue;
+
+      hash *= 31;
+      switch (it->opt.type) {
+      case optInt:
+         hash += it->opt.u.ival;
+         break;
+      case optBool:
+         hash += it->opt.u.bval;
+         break;
+      case optString:
+         hash += g_str_hash(it->opt.u.sval);
+         break;
+      }
+   }
+
+   return hash;
+}
+
+settings_t *use_settings(settings_t *settings)
+{
+   settings_t *prev = active;
+   active = settings;
+   return prev;
+}
+
+GVariant *modified_options(void)
+{
+   GVariantBuilder builder;
+   g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+   option_list_t *it;
+   for (it = (active ? active : options); it != NULL; it = it->next) {
+      if (!it->opt.modified)
+         continue;
+
+      GVariant *value = NULL;
+      switch (it->opt.type) {
+      case optInt:
+         value = g_variant_new_int32(it->opt.u.ival);
+         break;
+      case optBool:
+         value = g_variant_new_boolean(it->opt.u.bval);
+         break;
+      case optString:
+         value = g_variant_new_string(it->opt.u.sval);
+         break;
+      }
+      g_variant_builder_add(&builder, "{sv}", it->opt.name, value);
+   }
+
+   return g_variant_builder_end(&builder);
+}
+
+bool set_option_from_variant(const char *name, GVariant *value)
+{
+   option_t *opt = find_option(name);
+   if (opt == NULL)
+      return false;
+
+   switch (opt->type) {
+   case optInt:
+      if (!g_variant_is_of_type(value, G_VARIANT_TYPE_INT32))
+         return false;
+      set_int_option(name, g_variant_get_int32(value));
+      break;
+   case optBool:
+      if (!g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN))
+         return false;
+      set_bool_option(name, g_variant_get_boolean(value));
+      break;
+   case optString:
+      if (!g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+         return false;
+      set_string_option(name, g_variant_get_string(value, NULL));
+      break;
+   }
+
+   return true;
 }
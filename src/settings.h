@@ -21,6 +21,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include <glib.h>
+
 void add_int_option(const char *name, int ival);
 void add_bool_option(const char *name, bool bval);
 void add_string_option(const char *name, const char *sval);
@@ -33,4 +35,28 @@ void set_int_option(const char *name, int ival);
 void set_bool_option(const char *name, bool bval);
 void set_string_option(const char *name, const char *sval);
 
+// A snapshot of all the options that can be modified independently
+typedef struct _option_list_t settings_t;
+
+settings_t *copy_settings(void);
+void free_settings(settings_t *settings);
+
+// True if every option but ignore, which may be NULL, has the same
+// value in both.  NULL is the process-wide options.
+bool settings_equal(const settings_t *a, const settings_t *b,
+                    const char *ignore);
+
+// Equal settings have the same hash
+guint settings_hash(const settings_t *settings, const char *ignore);
+
+// Make the get and set functions use a snapshot rather than the
+// process-wide options until called again with NULL
+settings_t *use_settings(settings_t *settings);
+
+// Dictionary of options which have been set since they were added
+GVariant *modified_options(void);
+
+// Returns false if the option does not exist or has a different type
+bool set_option_from_variant(const char *name, GVariant *value);
+
 #endif
@@ -0,0 +1,277 @@
+/*  socket_server.c -- Accept requests on a Unix domain socket.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Serves the framing protocol described in daemon_client.h for clients
+ * which cannot reach the session bus.  Everything is asynchronous on
+ * the main loop: each connection reads one frame, submits it exactly
+ * as the Show method would and writes the reply before reading the
+ * next.  Clients can send many frames without waiting as the replies
+ * come back in order.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef WITH_DBUS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+
+#include "socket_server.h"
+#include "daemon_client.h"
+#include "xcowsayd.h"
+
+typedef struct {
+   GSocketConnection *connection;
+   GInputStream *in;
+   char *name;           // Takes the place of the bus name of a sender
+   guint32 header;
+   GByteArray *buf;
+} client_t;
+
+static GSocketService *service = NULL;
+static char *socket_path = NULL;
+static guint next_client = 1;
+static bool debug = false;
+
+static void read_header(client_t *client);
+
+static void close_client(client_t *client)
+{
+   debug_msg("Socket client %s disconnected\n", client->name);
+
+   daemon_forget_sender(client->name);
+
+   g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+   g_object_unref(client->in);
+   g_object_unref(client->connection);
+   g_byte_array_unref(client->buf);
+   g_free(client->name);
+   g_free(client);
+}
+
+// Errors reading or writing just mean the client went away
+static void client_error(client_t *client, GError *error)
+{
+   if (error != NULL) {
+      debug_msg("Socket client %s: %s\n", client->name, error->message);
+      g_error_free(error);
+   }
+
+   close_client(client);
+}
+
+static void reply_written(GObject *source, GAsyncResult *result,
+                          gpointer user_data)
+{
+   client_t *client = user_data;
+
+   GError *error = NULL;
+   if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result,
+                                         NULL, &error))
+      client_error(client, error);
+   else
+      read_header(client);
+}
+
+static void send_reply(client_t *client, guint32 id, GError *error)
+{
+   char *name = NULL;
+   if (error != NULL) {
+      name = g_dbus_error_encode_gerror(error);
+      g_dbus_error_strip_remote_error(error);
+   }
+
+   g_byte_array_set_size(client->buf, 0);
+   frame_append(client->buf,
+                g_variant_new("(uss)", id, name ? name : "",
+                              error ? error->message : ""));
+
+   g_free(name);
+   if (error != NULL)
+      g_error_free(error);
+
+   GOutputStream *out =
+      g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+   g_output_stream_write_all_async(out, client->buf->data, client->buf->len,
+                                   G_PRIORITY_DEFAULT, NULL,
+                                   reply_written, client);
+}
+
+static void handle_frame(client_t *client)
+{
+   GVariant *request = frame_parse(client->buf->data, client->buf->len,
+                                   G_VARIANT_TYPE("(ssa{sv})"));
+
+   const gchar *mode_name, *mess;
+   GVariant *options;
+   g_variant_get(request, "(&s&s@a{sv})", &mode_name, &mess, &options);
+
+   cowmode_t mode;
+   guint32 id = 0;
+   GError *error = NULL;
+   if (daemon_check_mode(mode_name, &mode, &error))
+      daemon_submit(client->name, mess, mode, options, &id, &error);
+
+   // The reply reuses the buffer the request was read into
+   g_variant_unref(options);
+   g_variant_unref(request);
+
+   send_reply(client, error ? 0 : id, error);
+}
+
+static void body_read(GObject *source, GAsyncResult *result,
+                      gpointer user_data)
+{
+   client_t *client = user_data;
+
+   gsize nread;
+   GError *error = NULL;
+   if (!g_input_stream_read_all_finish(G_INPUT_STREAM(source), result,
+                                       &nread, &error)
+       || nread < client->buf->len)
+      client_error(client, error);
+   else
+      handle_frame(client);
+}
+
+static void header_read(GObject *source, GAsyncResult *result,
+                        gpointer user_data)
+{
+   client_t *client = user_data;
+
+   gsize nread;
+   GError *error = NULL;
+   if (!g_input_stream_read_all_finish(G_INPUT_STREAM(source), result,
+                                       &nread, &error)
+       || nread < sizeof(client->header)) {
+      client_error(client, error);
+      return;
+   }
+
+   const guint32 length = GUINT32_FROM_LE(client->header);
+   if (length > SOCKET_MAX_FRAME) {
+      g_warning("Frame of %u bytes from socket client %s is too large",
+                length, client->name);
+      close_client(client);
+      return;
+   }
+
+   g_byte_array_set_size(client->buf, length);
+   g_input_stream_read_all_async(client->in, client->buf->data, length,
+                                 G_PRIORITY_DEFAULT, NULL, body_read,
+                                 client);
+}
+
+static void read_header(client_t *client)
+{
+   g_input_stream_read_all_async(client->in, &client->header,
+                                 sizeof(client->header), G_PRIORITY_DEFAULT,
+                                 NULL, header_read, client);
+}
+
+static gboolean on_incoming(GSocketService *service,
+                            GSocketConnection *connection,
+                            GObject *source_object, gpointer user_data)
+{
+   client_t *client = g_new0(client_t, 1);
+   client->connection = g_object_ref(connection);
+   client->in = g_buffered_input_stream_new(
+      g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+   client->name = g_strdup_printf("socket:%u", next_client++);
+   client->buf = g_byte_array_new();
+
+   debug_msg("Socket client %s connected\n", client->name);
+
+   // Rate limited along with any bus connections from the same process
+   GSocket *socket = g_socket_connection_get_socket(connection);
+   GCredentials *creds = g_socket_get_credentials(socket, NULL);
+   pid_t pid;
+   if (creds != NULL && (pid = g_credentials_get_unix_pid(creds, NULL)) > 0)
+      daemon_track_sender(client->name, pid);
+   g_clear_object(&creds);
+
+   read_header(client);
+   return TRUE;
+}
+
+void socket_server_init(bool debug_flag)
+{
+   debug = debug_flag;
+
+   socket_path = daemon_socket_path();
+
+   char *dir = g_path_get_dirname(socket_path);
+   g_mkdir_with_parents(dir, 0700);
+   g_free(dir);
+
+   // We own the bus name so any socket left here is stale
+   GStatBuf st;
+   if (g_lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+      g_unlink(socket_path);
+
+   GSocketAddress *address = g_unix_socket_address_new(socket_path);
+   service = g_socket_service_new();
+
+   GError *error = NULL;
+   if (!g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                      G_SOCKET_TYPE_STREAM,
+                                      G_SOCKET_PROTOCOL_DEFAULT,
+                                      NULL, NULL, &error)) {
+      g_warning("Cannot listen on %s: %s", socket_path, error->message);
+      g_error_free(error);
+      g_object_unref(address);
+      g_clear_object(&service);
+      g_free(socket_path);
+      socket_path = NULL;
+      return;
+   }
+
+   g_object_unref(address);
+
+   g_chmod(socket_path, 0600);
+
+   g_signal_connect(service, "incoming", G_CALLBACK(on_incoming), NULL);
+   g_socket_service_start(service);
+
+   debug_msg("Listening on %s\n", socket_path);
+}
+
+void socket_server_shutdown(void)
+{
+   if (NULL == service)
+      return;
+
+   g_socket_service_stop(service);
+   g_socket_listener_close(G_SOCKET_LISTENER(service));
+   g_clear_object(&service);
+
+   g_unlink(socket_path);
+   g_free(socket_path);
+   socket_path = NULL;
+}
+
+#endif /* #ifdef WITH_DBUS */
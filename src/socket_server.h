@@ -0,0 +1,27 @@
+/*  socket_server.h -- Accept requests on a Unix domain socket.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_SOCKET_SERVER_H
+#define INC_SOCKET_SERVER_H
+
+#include <stdbool.h>
+
+// Listen on daemon_socket_path() from the main loop
+void socket_server_init(bool debug);
+void socket_server_shutdown(void);
+
+#endif
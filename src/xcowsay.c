@@ -34,6 +34,7 @@
 #include <errno.h>
 
 #include "display_cow.h"
+#include "follow.h"
 #include "settings.h"
 #include "xcowsayd.h"
 #include "config_file.h"
@@ -52,12 +53,20 @@
 #define DEF_DREAM_TIME    10000
 #define DEF_ALT_IMAGE     ""
 #define DEF_BUBBLE_X      5  // Distance from cow to bubble
+#define DEF_QUEUE_SIZE    256   // Pending requests held by the daemon
+#define DEF_QUEUE_FULL    "reject"
+#define DEF_RATE_BURST    20    // Requests a client can send at once
+#define DEF_PREEMPT_PRIORITY 2   // Critical messages replace the one on screen
+#define DEF_BUBBLE_CACHE  4096  // KiB of rendered bubbles kept for reuse
 
-#define MAX_STDIN 4096   // Maximum chars to read from stdin
+#define MAX_STDIN 4096   // Initial size of the buffer for standard input
 
 static int daemon_flag = 0;
 static int debug = 0;
 static int think_flag = 0;
+static int null_flag = 0;
+static int wait_flag = 0;
+static int follow_flag = 0;
 
 static struct option long_options[] = {
    {"help", no_argument, 0, 'h'},
@@ -78,20 +87,71 @@ static struct option long_options[] = {
    {"config", required_argument, 0, 'o'},
    {"debug", no_argument, &debug, 1},
    {"release", no_argument, 0, 'R'},
+   {"null", no_argument, 0, '0'},
+   {"wait", no_argument, &wait_flag, 1},
+   {"ttl", required_argument, 0, 'T'},
+   {"follow", no_argument, &follow_flag, 1},
    {0, 0, 0, 0}
 };
 
-static void read_from_stdin(cowmode_t mode)
+// Read the whole of standard input into a NUL-terminated buffer
+static char *read_all_stdin(size_t *len)
 {
-   char *data = malloc(MAX_STDIN);
-   size_t n = fread(data, 1, MAX_STDIN, stdin);
-   if (n == MAX_STDIN) {
-      fprintf(stderr, "Warning: Excess input truncated\n");
-      n--;
+   size_t size = MAX_STDIN, n;
+   char *data = malloc(size);
+   assert(data);
+
+   *len = 0;
+   while ((n = fread(data + *len, 1, size - *len - 1, stdin)) > 0) {
+      *len += n;
+      if (*len + 1 == size) {
+         size *= 2;
+         data = realloc(data, size);
+         assert(data);
+      }
+   }
+   data[*len] = '\0';
+
+   return data;
+}
+
+static void read_from_stdin(cowmode_t mode, int *argc, char ***argv)
+{
+   size_t len;
+   char *data = read_all_stdin(&len);
+
+   display_cow_or_invoke_daemon(debug, data, mode, wait_flag, argc, argv);
+   free(data);
+}
+
+/*
+ * Read all of standard input and display each NUL-terminated record
+ * as a separate message.
+ */
+static void read_records_from_stdin(cowmode_t mode, int *argc, char ***argv)
+{
+   size_t len;
+   char *data = read_all_stdin(&len);
+
+   int max = 1;
+   for (size_t i = 0; i < len; i++) {
+      if (data[i] == '\0')
+         max++;
+   }
+
+   char **records = malloc(max * sizeof(char*));
+   assert(records);
+
+   // Skip empty records such as the one after a trailing NUL
+   int count = 0;
+   for (char *p = data; p < data + len; p += strlen(p) + 1) {
+      if (*p != '\0')
+         records[count++] = p;
    }
-   data[n] = '\0';
 
-   display_cow_or_invoke_daemon(debug, data, mode);
+   display_cows_or_invoke_daemon(debug, records, count, mode, wait_flag,
+                                 argc, argv);
+   free(records);
    free(data);
 }
 
@@ -108,8 +168,12 @@ static void usage()
       " -f, --font=FONT\t%s\n"
       " -d, --dream=FILE\t%s\n"
       " -l, --left\t\t%s\n"
+      " -0, --null\t\t%s\n"
       "     --think\t\t%s\n"
       "     --daemon\t\t%s\n"
+      "     --wait\t\t%s\n"
+      "     --ttl=SECONDS\t%s\n"
+      "     --follow\t\t%s\n"
       "     --cow-size=SIZE\t%s\n"
       "     --image=FILE\t%s\n"
       "     --monitor=N\t%s\n"
@@ -132,8 +196,12 @@ static void usage()
       i18n("Set message font (Pango format)."),
       i18n("Display an image instead of text."),
       i18n("Make the bubble appear to the left of cow."),
+      i18n("Read NUL-separated messages from standard input."),
       i18n("Display a thought bubble rather than a speech bubble."),
       i18n("Run xcowsay in daemon mode."),
+      i18n("Wait for the daemon to dismiss the cow before exiting."),
+      i18n("Discard the message if the daemon cannot show it in time."),
+      i18n("Show each line of standard input as it arrives."),
       i18n("Size of the cow (small, med, large)."),
       i18n("Use a different image instead of the cow."),
       i18n("Display cow on monitor N."),
@@ -265,11 +333,27 @@ int main(int argc, char **argv)
    add_bool_option("wrap", true);
    add_bool_option("left", false);
    add_string_option("close_event", "button-press-event");
+   add_int_option("queue_size", DEF_QUEUE_SIZE);
+   add_string_option("queue_full", DEF_QUEUE_FULL);
+   add_bool_option("notifications", false);
+   add_int_option("preempt_priority", DEF_PREEMPT_PRIORITY);
+   add_bool_option("coalesce", true);
+   add_int_option("digest_threshold", 0);
+   add_int_option("ttl", 0);
+   add_int_option("rate_limit", 0);
+   add_int_option("rate_burst", DEF_RATE_BURST);
+   add_bool_option("group_by_session", false);
+   add_bool_option("journal", false);
+   add_bool_option("socket", false);
+   add_bool_option("prerender", true);
+   add_bool_option("warm_up", false);
+   add_int_option("bubble_cache", DEF_BUBBLE_CACHE);
+   add_int_option("disk_cache", 0);
 
    parse_config_file();
 
    int c, index = 0, failure = 0, dtime;
-   const char *spec = "hvld:r:t:f:";
+   const char *spec = "hvl0d:r:t:f:";
    const char *dream_file = NULL;
    while ((c = getopt_long(argc, argv, spec, long_options, &index)) != -1) {
       switch (c) {
@@ -293,6 +377,9 @@ int main(int argc, char **argv)
          set_int_option("display_time", dtime);
          set_int_option("min_display_time", dtime);
          break;
+      case 'T':
+         set_int_option("ttl", (int)(parse_float_option(optarg)*1000.0));
+         break;
       case 'r':
          set_int_option("reading_speed", parse_int_option(optarg));
          break;
@@ -334,6 +421,9 @@ int main(int argc, char **argv)
       case 'R':
          set_string_option("close_event", "button-release-event");
          break;
+      case '0':
+         null_flag = 1;
+         break;
       case '?':
          // getopt_long already printed an error message
          failure = 1;
@@ -355,8 +445,6 @@ int main(int argc, char **argv)
       run_cowsay_daemon(debug, argc, argv);
    }
    else {
-      cowsay_init(&argc, &argv);
-
       if (dream_file != NULL) {
          // Make path absolute
          char *abs_path = realpath(dream_file, NULL);
@@ -370,15 +458,24 @@ int main(int argc, char **argv)
             exit(EXIT_FAILURE);
          }
 
-         display_cow_or_invoke_daemon(debug, abs_path, COWMODE_DREAM);
+         display_cow_or_invoke_daemon(debug, abs_path, COWMODE_DREAM,
+                                      wait_flag, &argc, &argv);
          free(abs_path);
       }
+      else if (optind == argc && follow_flag) {
+         follow_stdin(debug, mode, null_flag ? '\0' : '\n', wait_flag,
+                      &argc, &argv);
+      }
+      else if (optind == argc && null_flag) {
+         read_records_from_stdin(mode, &argc, &argv);
+      }
       else if (optind == argc) {
-         read_from_stdin(mode);
+         read_from_stdin(mode, &argc, &argv);
       }
       else {
          char *str = cat_from_index(optind, argc, argv);
-         display_cow_or_invoke_daemon(debug, str, mode);
+         display_cow_or_invoke_daemon(debug, str, mode, wait_flag,
+                                      &argc, &argv);
          free(str);
       }
    }
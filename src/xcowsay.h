@@ -0,0 +1,51 @@
+/*  xcowsay.h -- Definitions shared by the xcowsay programs.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INC_XCOWSAY_H
+#define INC_XCOWSAY_H
+
+#include <stdio.h>
+
+#include <glib.h>
+
+#define XCOWSAY_PATH      "/uk/me/doof/Cowsay"
+#define XCOWSAY_NAMESPACE "uk.me.doof.Cowsay"
+
+#define XCOWSAY_ERROR_QUEUE_FULL   XCOWSAY_NAMESPACE ".Error.QueueFull"
+#define XCOWSAY_ERROR_RATE_LIMITED XCOWSAY_NAMESPACE ".Error.RateLimited"
+
+#define debug_msg(...) if (debug) printf(__VA_ARGS__);
+#define debug_err(...) if (debug) g_printerr(__VA_ARGS__);
+
+typedef enum {
+   COWMODE_NORMAL,
+   COWMODE_DREAM,
+   COWMODE_THINK,
+} cowmode_t;
+
+// Why a request went away, sent with the Dismissed signal
+typedef enum {
+   DISMISS_TIMEOUT,
+   DISMISS_CLICKED,
+   DISMISS_DROPPED,   // Never displayed because the queue was full
+   DISMISS_CANCELLED,
+   DISMISS_PREEMPTED, // Cut short by a more urgent request
+   DISMISS_EXPIRED,   // Waited longer than its time to live
+   DISMISS_DIGESTED,  // Summarised along with the rest of the backlog
+} dismiss_reason_t;
+
+#endif
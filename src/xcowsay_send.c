@@ -0,0 +1,697 @@
+/*  xcowsay_send.c -- Lightweight client for the xcowsay daemon.
+ *  Copyright (C) 2008-2022  Nick Gasson
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This only links against GIO so it starts much faster than xcowsay
+ * itself.  If the daemon is not running it hands over to xcowsay with
+ * the same arguments.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "daemon_client.h"
+#include "i18n.h"
+
+#define MAX_STDIN 4096   // Initial size of the buffer for standard input
+
+static int debug = 0;
+static int think_flag = 0;
+static int null_flag = 0;
+static int wait_flag = 0;
+static int print_id_flag = 0;
+static int list_flag = 0;
+static int flush_flag = 0;
+static int dismiss_flag = 0;
+static int stats_flag = 0;
+
+static struct option long_options[] = {
+   {"help", no_argument, 0, 'h'},
+   {"version", no_argument, 0, 'v'},
+   {"dream", required_argument, 0, 'd'},
+   {"think", no_argument, &think_flag, 1},
+   {"null", no_argument, 0, '0'},
+   {"wait", no_argument, &wait_flag, 1},
+   {"replaces", required_argument, 0, 'I'},
+   {"print-id", no_argument, &print_id_flag, 1},
+   {"priority", required_argument, 0, 'P'},
+   {"ttl", required_argument, 0, 'T'},
+   {"list", no_argument, &list_flag, 1},
+   {"cancel", required_argument, 0, 'C'},
+   {"flush", no_argument, &flush_flag, 1},
+   {"dismiss", no_argument, &dismiss_flag, 1},
+   {"stats", no_argument, &stats_flag, 1},
+   {"time", required_argument, 0, 't'},
+   {"font", required_argument, 0, 'f'},
+   {"cow-size", required_argument, 0, 'c'},
+   {"reading-speed", required_argument, 0, 'r'},
+   {"image", required_argument, 0, 'i'},
+   {"monitor", required_argument, 0, 'm'},
+   {"bubble-at", required_argument, 0, 'b'},
+   {"at", required_argument, 0, 'a'},
+   {"no-wrap", no_argument, 0, 'w'},
+   {"left", no_argument, 0, 'l'},
+   {"release", no_argument, 0, 'R'},
+   {"debug", no_argument, &debug, 1},
+   {0, 0, 0, 0}
+};
+
+static void usage()
+{
+   printf(
+      "%s: xcowsay-send [OPTION]... [MESSAGE]...\n"
+      "%s\n\n"
+      "%s:\n"
+      " -h, --help\t\t%s\n"
+      " -v, --version\t\t%s\n"
+      " -d, --dream=FILE\t%s\n"
+      " -0, --null\t\t%s\n"
+      " -t, --time=SECONDS\t%s\n"
+      " -r, --reading-speed=N\t%s\n"
+      " -f, --font=FONT\t%s\n"
+      " -l, --left\t\t%s\n"
+      "     --cow-size=SIZE\t%s\n"
+      "     --image=FILE\t%s\n"
+      "     --monitor=N\t%s\n"
+      "     --at=X,Y\t\t%s\n"
+      "     --bubble-at=X,Y\t%s\n"
+      "     --no-wrap\t\t%s\n"
+      "     --release\t\t%s\n"
+      "     --think\t\t%s\n"
+      "     --wait\t\t%s\n"
+      "     --replaces=ID\t%s\n"
+      "     --print-id\t\t%s\n"
+      "     --priority=LEVEL\t%s\n"
+      "     --ttl=SECONDS\t%s\n"
+      "     --list\t\t%s\n"
+      "     --cancel=ID\t%s\n"
+      "     --flush\t\t%s\n"
+      "     --dismiss\t\t%s\n"
+      "     --stats\t\t%s\n"
+      "     --debug\t\t%s\n\n"
+      "%s\n\n"
+      "%s\n",
+      i18n("Usage"),
+      i18n("Pass MESSAGE or standard input to the xcowsay daemon."),
+      i18n("Options"),
+      i18n("Display this message and exit."),
+      i18n("Print version information."),
+      i18n("Display an image instead of text."),
+      i18n("Read NUL-separated messages from standard input."),
+      i18n("Number of seconds to display message for."),
+      i18n("Number of milliseconds to delay between each word."),
+      i18n("Set message font (Pango format)."),
+      i18n("Make the cow face left."),
+      i18n("Size of the cow (small, med, large)."),
+      i18n("Use a different image instead of the cow."),
+      i18n("Display cow on this monitor."),
+      i18n("Force the cow to appear at screen location (X,Y)."),
+      i18n("Change the position of the bubble."),
+      i18n("Disable word wrapping."),
+      i18n("Close the cow when the mouse button is released."),
+      i18n("Display a thought bubble rather than a speech bubble."),
+      i18n("Wait for the daemon to dismiss the cow before exiting."),
+      i18n("Update the text of an earlier message if it is still shown."),
+      i18n("Print the ID of each message sent to the daemon."),
+      i18n("Priority of the message (low, normal, critical)."),
+      i18n("Discard the message if it is not shown within SECONDS."),
+      i18n("List the messages waiting in the daemon's queue."),
+      i18n("Remove a message from the queue or the screen."),
+      i18n("Remove every message waiting in the queue."),
+      i18n("Take the cow currently on screen away."),
+      i18n("Print the daemon's counters."),
+      i18n("Print messages about what xcowsay-send is doing."),
+      i18n("If the daemon is not running xcowsay is run instead with the "
+         "same arguments."),
+      i18n("Report bugs to nick@nickg.me.uk"));
+}
+
+static void version()
+{
+#ifdef HAVE_CONFIG_H
+   puts(PACKAGE_STRING);
+#endif
+}
+
+/*
+ * Remove the options which only make sense with a daemon as xcowsay
+ * does not understand them.
+ */
+static void strip_daemon_options(char **argv)
+{
+   static const char *with_arg[] = { "--replaces", "--priority", NULL };
+
+   char **out = argv;
+   for (char **in = argv; *in != NULL; in++) {
+      bool strip = (strcmp(*in, "--print-id") == 0);
+      for (const char **opt = with_arg; *opt != NULL && !strip; opt++) {
+         const size_t len = strlen(*opt);
+         if (strncmp(*in, *opt, len) != 0)
+            continue;
+         else if ((*in)[len] == '=')
+            strip = true;
+         else if ((*in)[len] == '\0' && *(in + 1) != NULL) {
+            strip = true;
+            in++;
+         }
+      }
+
+      if (!strip)
+         *out++ = *in;
+   }
+   *out = NULL;
+}
+
+/*
+ * Replace this process with the full xcowsay binary.  Look in the
+ * same directory as xcowsay-send first and then on the PATH.
+ */
+static void exec_xcowsay(char **argv)
+{
+   strip_daemon_options(argv);
+
+   if (strchr(argv[0], '/') != NULL) {
+      char *self = strdup(argv[0]);
+      char *path;
+      if (asprintf(&path, "%s/xcowsay", dirname(self)) != -1) {
+         debug_msg("Running %s\n", path);
+         argv[0] = path;
+         execv(path, argv);
+         free(path);
+      }
+      free(self);
+   }
+
+   debug_msg("Running xcowsay from PATH\n");
+   argv[0] = "xcowsay";
+   execvp("xcowsay", argv);
+
+   perror("xcowsay");
+   exit(EXIT_FAILURE);
+}
+
+// Give xcowsay the standard input that was already read
+static void restore_stdin(const char *data, size_t len)
+{
+   FILE *tmp = tmpfile();
+   if (NULL == tmp || fwrite(data, 1, len, tmp) != len || fflush(tmp) != 0
+       || fseek(tmp, 0, SEEK_SET) != 0
+       || dup2(fileno(tmp), STDIN_FILENO) == -1) {
+      perror("tmpfile");
+      exit(EXIT_FAILURE);
+   }
+}
+
+static void not_running(void)
+{
+   fprintf(stderr, i18n("Error: the daemon is not running\n"));
+   exit(EXIT_FAILURE);
+}
+
+static int parse_int_option(const char *optarg)
+{
+   char *endptr;
+   int r = strtol(optarg, &endptr, 10);
+   if ('\0' == *endptr)
+      return r;
+   else {
+      fprintf(stderr, i18n("Error: %s is not a valid integer\n"), optarg);
+      exit(EXIT_FAILURE);
+   }
+}
+
+static double parse_float_option(const char *optarg)
+{
+   char *endptr;
+   double r = strtod(optarg, &endptr);
+   if ('\0' == *endptr)
+      return r;
+   else {
+      fprintf(stderr, i18n("Error: %s is not a valid number\n"), optarg);
+      exit(EXIT_FAILURE);
+   }
+}
+
+static void parse_position_option(const char *optarg, int *x, int *y)
+{
+   const char *failmsg = i18n("Error: failed to parse '%s' as position\n");
+
+   char *comma = strchr(optarg, ',');
+   if (comma == NULL) {
+      fprintf(stderr, failmsg, optarg);
+      exit(EXIT_FAILURE);
+   }
+
+   char *endptr;
+   *x = strtol(optarg, &endptr, 10);
+   if (endptr != comma || endptr == optarg) {
+      fprintf(stderr, failmsg, optarg);
+      exit(EXIT_FAILURE);
+   }
+
+   *y = strtol(comma + 1, &endptr, 10);
+   if (*endptr != '\0') {
+      fprintf(stderr, failmsg, optarg);
+      exit(EXIT_FAILURE);
+   }
+}
+
+static int parse_priority_option(const char *optarg)
+{
+   static const char *names[] = { "low", "normal", "critical" };
+
+   for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+      if (strcmp(optarg, names[i]) == 0)
+         return i;
+   }
+
+   return parse_int_option(optarg);
+}
+
+// The daemon may have a different working directory
+static char *absolute_path(const char *file)
+{
+   char *path = realpath(file, NULL);
+   if (path == NULL) {
+      perror(file);
+      exit(EXIT_FAILURE);
+   }
+
+   if (access(path, R_OK) != 0) {
+      perror(path);
+      exit(EXIT_FAILURE);
+   }
+
+   return path;
+}
+
+// Use the socket if there is one or else the bus
+static daemon_status_t send_messages(GDBusConnection *connection,
+                                     GSocketConnection *sock,
+                                     char **texts, int count, cowmode_t mode,
+                                     GVariant *options, guint32 *ids)
+{
+   if (sock != NULL)
+      return socket_show(debug, sock, texts, count, mode, options, ids);
+   else if (count == 1)
+      return daemon_show(debug, connection, texts[0], mode, options, ids);
+   else
+      return daemon_show_batch(debug, connection, texts, count, mode,
+                               options, ids);
+}
+
+static GVariant *call_daemon(GDBusConnection *connection, const char *method,
+                             GVariant *parameters, const char *reply_type)
+{
+   GError *error = NULL;
+   GVariant *reply = g_dbus_connection_call_sync(
+      connection, XCOWSAY_NAMESPACE, XCOWSAY_PATH, XCOWSAY_NAMESPACE,
+      method, parameters, G_VARIANT_TYPE(reply_type),
+      G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL, &error);
+   if (NULL == reply && daemon_absent(error))
+      not_running();
+   else if (NULL == reply) {
+      g_dbus_error_strip_remote_error(error);
+      fprintf(stderr, i18n("Error: %s failed: %s\n"), method, error->message);
+      exit(EXIT_FAILURE);
+   }
+
+   return reply;
+}
+
+// Handle the options which manage the queue rather than send messages
+static void control_daemon(GDBusConnection *connection, int cancel_id)
+{
+   GVariant *reply;
+   gboolean found;
+
+   if (list_flag) {
+      reply = call_daemon(connection, "ListRequests", NULL, "(a(usut))");
+
+      GVariantIter *iter;
+      guint32 id, size;
+      const gchar *mode;
+      guint64 age;
+      g_variant_get(reply, "(a(usut))", &iter);
+      while (g_variant_iter_next(iter, "(u&sut)", &id, &mode, &size, &age))
+         printf("%u\t%s\t%u\t%.1f\n", id, mode, size, age / 1000.0);
+      g_variant_iter_free(iter);
+      g_variant_unref(reply);
+   }
+
+   if (cancel_id != 0) {
+      reply = call_daemon(connection, "Cancel",
+                          g_variant_new("(u)", (guint32)cancel_id), "(b)");
+      g_variant_get(reply, "(b)", &found);
+      g_variant_unref(reply);
+
+      if (!found) {
+         fprintf(stderr, i18n("Error: no message with ID %d\n"), cancel_id);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (flush_flag) {
+      guint32 count;
+      reply = call_daemon(connection, "Flush", NULL, "(u)");
+      g_variant_get(reply, "(u)", &count);
+      g_variant_unref(reply);
+      debug_msg("Flushed %u messages\n", count);
+   }
+
+   if (dismiss_flag) {
+      reply = call_daemon(connection, "Dismiss", NULL, "(b)");
+      g_variant_unref(reply);
+   }
+
+   if (stats_flag) {
+      reply = call_daemon(connection, "GetStatistics", NULL, "(a{sv})");
+
+      GVariantIter *iter;
+      const gchar *name;
+      GVariant *value;
+      g_variant_get(reply, "(a{sv})", &iter);
+      while (g_variant_iter_next(iter, "{&sv}", &name, &value)) {
+         char *str = g_variant_print(value, FALSE);
+         printf("%s\t%s\n", name, str);
+         g_free(str);
+         g_variant_unref(value);
+      }
+      g_variant_iter_free(iter);
+      g_variant_unref(reply);
+   }
+}
+
+static char *read_all_stdin(size_t *len)
+{
+   size_t size = MAX_STDIN, n;
+   char *data = malloc(size);
+   g_assert(data);
+
+   *len = 0;
+   while ((n = fread(data + *len, 1, size - *len - 1, stdin)) > 0) {
+      *len += n;
+      if (*len + 1 == size) {
+         size *= 2;
+         data = realloc(data, size);
+         g_assert(data);
+      }
+   }
+   data[*len] = '\0';
+
+   return data;
+}
+
+/*
+ * Split the buffer into NUL-terminated records, skipping empty ones
+ * such as the one after a trailing NUL.
+ */
+static char **split_records(char *data, size_t len, int *count)
+{
+   int max = 1;
+   for (size_t i = 0; i < len; i++) {
+      if (data[i] == '\0')
+         max++;
+   }
+
+   char **records = g_new(char *, max);
+
+   *count = 0;
+   for (char *p = data; p < data + len; p += strlen(p) + 1) {
+      if (*p != '\0')
+         records[(*count)++] = p;
+   }
+
+   return records;
+}
+
+static char *cat_from_index(int ind, int argc, char **argv)
+{
+   size_t len = 0, i;
+   for (i = ind; i < argc; i++)
+      len += strlen(argv[i]) + (i < argc - 1 ? 1 : 0);
+
+   char *buf = malloc(len+1);
+   g_assert(buf);
+
+   char *p = buf;
+   for (i = ind; i < argc; i++) {
+      strcpy(p, argv[i]);
+      p += strlen(argv[i]);
+      if (i < argc - 1)  // No space at the end
+         *p++ = ' ';
+   }
+   *p = '\0';
+
+   return buf;
+}
+
+int main(int argc, char **argv)
+{
+   setlocale(LC_ALL, "");
+   bindtextdomain(PACKAGE, LOCALEDIR);
+   textdomain(PACKAGE);
+
+   // getopt_long permutes argv so keep a copy to pass on to xcowsay
+   char **orig_argv = g_new0(char *, argc + 1);
+   memcpy(orig_argv, argv, argc * sizeof(char *));
+
+   // Display options use the same names as the configuration file
+   GVariantDict options;
+   g_variant_dict_init(&options, NULL);
+
+   int c, index = 0, failure = 0, dtime, x, y, cancel_id = 0;
+   const char *spec = "hvl0d:r:t:f:";
+   const char *dream_file = NULL;
+   char *image = NULL;
+   while ((c = getopt_long(argc, argv, spec, long_options, &index)) != -1) {
+      switch (c) {
+      case 0:
+         // Set a flag
+         break;
+      case 'd':
+         dream_file = optarg;
+         break;
+      case '0':
+         null_flag = 1;
+         break;
+      case 't':
+         dtime = (int)(parse_float_option(optarg)*1000.0);
+         g_variant_dict_insert(&options, "display_time", "i", dtime);
+         g_variant_dict_insert(&options, "min_display_time", "i", dtime);
+         break;
+      case 'T':
+         g_variant_dict_insert(&options, "ttl", "i",
+                               (int)(parse_float_option(optarg)*1000.0));
+         break;
+      case 'r':
+         g_variant_dict_insert(&options, "reading_speed", "i",
+                               parse_int_option(optarg));
+         break;
+      case 'f':
+         g_variant_dict_insert(&options, "font", "s", optarg);
+         break;
+      case 'c':
+         g_variant_dict_insert(&options, "cow_size", "s", optarg);
+         break;
+      case 'i':
+         free(image);
+         image = absolute_path(optarg);
+         g_variant_dict_insert(&options, "alt_image", "s", image);
+         break;
+      case 'm':
+         g_variant_dict_insert(&options, "monitor", "i",
+                               parse_int_option(optarg));
+         break;
+      case 'a':
+         parse_position_option(optarg, &x, &y);
+         g_variant_dict_insert(&options, "at_x", "i", x);
+         g_variant_dict_insert(&options, "at_y", "i", y);
+         break;
+      case 'b':
+         parse_position_option(optarg, &x, &y);
+         g_variant_dict_insert(&options, "bubble_x", "i", x);
+         g_variant_dict_insert(&options, "bubble_y", "i", y);
+         break;
+      case 'w':
+         g_variant_dict_insert(&options, "wrap", "b", FALSE);
+         break;
+      case 'l':
+         g_variant_dict_insert(&options, "left", "b", TRUE);
+         break;
+      case 'R':
+         g_variant_dict_insert(&options, "close_event", "s",
+                               "button-release-event");
+         break;
+      case 'P':
+         g_variant_dict_insert(&options, "priority", "i",
+                               parse_priority_option(optarg));
+         break;
+      case 'C':
+         cancel_id = parse_int_option(optarg);
+         break;
+      case 'I':
+         g_variant_dict_insert(&options, "replaces", "u",
+                               (guint32)parse_int_option(optarg));
+         break;
+      case 'h':
+         usage();
+         exit(EXIT_SUCCESS);
+      case 'v':
+         version();
+         exit(EXIT_SUCCESS);
+      case '?':
+         // getopt_long already printed an error message
+         failure = 1;
+         break;
+      default:
+         abort();
+      }
+   }
+   if (failure)
+      exit(EXIT_FAILURE);
+
+   // Whether the daemon is running is only found out by calling it
+   GDBusConnection *connection = daemon_connection(debug);
+
+   if (list_flag || cancel_id != 0 || flush_flag || dismiss_flag
+       || stats_flag) {
+      if (NULL == connection)
+         not_running();
+
+      control_daemon(connection, cancel_id);
+
+      g_variant_dict_clear(&options);
+      g_object_unref(connection);
+      g_free(orig_argv);
+      return EXIT_SUCCESS;
+   }
+
+   // Without a session bus the daemon may still be listening on its socket
+   GSocketConnection *sock = NULL;
+   if (NULL == connection)
+      sock = daemon_socket(debug);
+
+   if (NULL == connection && NULL == sock)
+      exec_xcowsay(orig_argv);
+
+   cowmode_t mode = think_flag ? COWMODE_THINK : COWMODE_NORMAL;
+   GVariant *opts = g_variant_dict_end(&options);
+
+   daemon_waiter_t *waiter = NULL;
+   if (wait_flag && sock != NULL)
+      fprintf(stderr, i18n("Warning: cannot wait for the daemon without "
+                           "a session bus\n"));
+   else if (wait_flag)
+      waiter = daemon_wait_begin(debug, connection);
+
+   daemon_status_t status;
+   guint32 *ids = NULL;
+   int count = 1;
+   char *text;
+   bool from_stdin = false;
+   size_t len = 0;
+   if (dream_file != NULL) {
+      text = absolute_path(dream_file);
+      ids = g_new(guint32, 1);
+      status = send_messages(connection, sock, &text, 1, COWMODE_DREAM,
+                             opts, ids);
+   }
+   else if (optind == argc && null_flag) {
+      text = read_all_stdin(&len);
+      from_stdin = true;
+
+      char **records = split_records(text, len, &count);
+      ids = g_new(guint32, count);
+      if (count > 0)
+         status = send_messages(connection, sock, records, count, mode,
+                                opts, ids);
+      else {
+         g_variant_unref(g_variant_ref_sink(opts));
+         status = DAEMON_OK;
+      }
+      g_free(records);
+   }
+   else {
+      if (optind == argc) {
+         text = read_all_stdin(&len);
+         from_stdin = true;
+      }
+      else
+         text = cat_from_index(optind, argc, argv);
+
+      ids = g_new(guint32, 1);
+      status = send_messages(connection, sock, &text, 1, mode, opts, ids);
+   }
+
+   // Nothing was queued so hand over to xcowsay
+   if (status == DAEMON_ABSENT) {
+      if (waiter != NULL)
+         daemon_wait_end(waiter, NULL, 0);
+      if (from_stdin)
+         restore_stdin(text, len);
+      exec_xcowsay(orig_argv);
+   }
+
+   if (status == DAEMON_OK && print_id_flag) {
+      for (int i = 0; i < count; i++)
+         printf("%u\n", ids[i]);
+      fflush(stdout);
+   }
+
+   if (waiter != NULL) {
+      if (status != DAEMON_OK)
+         daemon_wait_end(waiter, NULL, 0);
+      else if (!daemon_wait_end(waiter, ids, count)) {
+         fprintf(stderr, i18n("Error: daemon exited before the message "
+                              "was dismissed\n"));
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   switch (status) {
+   case DAEMON_OK:
+      break;
+   case DAEMON_REJECTED:
+   case DAEMON_LOST:
+      exit(EXIT_FAILURE);
+   case DAEMON_UNAVAILABLE:
+   case DAEMON_ABSENT:
+      fprintf(stderr, i18n("Error: failed to send message to daemon\n"));
+      exit(EXIT_FAILURE);
+   }
+
+   g_free(ids);
+   free(text);
+   free(image);
+   if (connection != NULL)
+      g_object_unref(connection);
+   if (sock != NULL)
+      g_object_unref(sock);
+   g_free(orig_argv);
+
+   return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 /*  xcowsayd.c -- DBus xcowsay daemon.
- *  Copyright (C) 2008-2020  Nick Gasson
+ *  Copyright (C) 2008-2022  Nick Gasson
  *
  *  This program is free software: you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -29,197 +29,1428 @@
 
 #ifdef WITH_DBUS
 
-#include <dbus/dbus-glib-bindings.h>
+#include <gio/gio.h>
 
 #include "display_cow.h"
+#include "bubble_cache.h"
+#include "request_queue.h"
+#include "settings.h"
+#include "notifications.h"
+#include "journal.h"
+#include "socket_server.h"
 
+// Keep this in sync with cowsay.xml
+static const char introspection_xml[] =
+   "<node>"
+   "  <interface name='" XCOWSAY_NAMESPACE "'>"
+   "    <method name='ShowCow'>"
+   "      <arg type='s' name='mess' direction='in'/>"
+   "    </method>"
+   "    <method name='Think'>"
+   "      <arg type='s' name='mess' direction='in'/>"
+   "    </method>"
+   "    <method name='Dream'>"
+   "      <arg type='s' name='file' direction='in'/>"
+   "    </method>"
+   "    <method name='Show'>"
+   "      <arg type='s' name='mode' direction='in'/>"
+   "      <arg type='s' name='message' direction='in'/>"
+   "      <arg type='a{sv}' name='options' direction='in'/>"
+   "      <arg type='u' name='id' direction='out'/>"
+   "    </method>"
+   "    <method name='ShowBatch'>"
+   "      <arg type='a(ssa{sv})' name='requests' direction='in'/>"
+   "      <arg type='au' name='ids' direction='out'/>"
+   "    </method>"
+   "    <method name='ListRequests'>"
+   "      <arg type='a(usut)' name='requests' direction='out'/>"
+   "    </method>"
+   "    <method name='Cancel'>"
+   "      <arg type='u' name='id' direction='in'/>"
+   "      <arg type='b' name='found' direction='out'/>"
+   "    </method>"
+   "    <method name='Flush'>"
+   "      <arg type='u' name='count' direction='out'/>"
+   "    </method>"
+   "    <method name='Dismiss'>"
+   "      <arg type='b' name='found' direction='out'/>"
+   "    </method>"
+   "    <method name='GetStatistics'>"
+   "      <arg type='a{sv}' name='statistics' direction='out'/>"
+   "    </method>"
+   "    <signal name='Queued'>"
+   "      <arg type='u' name='id'/>"
+   "    </signal>"
+   "    <signal name='Displayed'>"
+   "      <arg type='u' name='id'/>"
+   "    </signal>"
+   "    <signal name='Dismissed'>"
+   "      <arg type='u' name='id'/>"
+   "      <arg type='s' name='reason'/>"
+   "    </signal>"
+   "  </interface>"
+   "</node>";
+
+// Options which a client may set for an individual request
+static const char *request_options[] = {
+   "lead_in_time", "display_time", "lead_out_time", "min_display_time",
+   "max_display_time", "reading_speed", "dream_time", "font", "cow_size",
+   "image_base", "alt_image", "monitor", "at_x", "at_y", "bubble_x",
+   "bubble_y", "wrap", "left", "close_event", "ttl", NULL
+};
+
+#define DRAIN_BATCH  64   // Flushed requests to free per idle callback
+#define DIGEST_LINES 5    // Messages quoted in a digest bubble
+#define DIGEST_WIDTH 40   // Characters of each message quoted
+#define SWEEP_INTERVAL 60 // Seconds between dropping idle client state
+#define RESOLVE_TIMEOUT 1000   // Milliseconds to wait for a client's PID
+
+// Token bucket limiting how fast one client can send requests
 typedef struct {
-   GObject parent;
-   DBusGConnection *connection;
-} Cowsay;
+   double tokens;
+   gint64 updated;
+} bucket_t;
 
+// A method call put off until we know who sent it
 typedef struct {
-   GObjectClass parent_class;
-} CowsayClass;
+   GDBusMethodInvocation *invocation;
+   daemon_call_t call;
+} pending_call_t;
 
+// A connection on the bus or the socket and the client it belongs to
+typedef struct {
+   char *key;             // NULL until the process has been looked up
+   guint subscription;    // NameOwnerChanged for this name or zero
+   GQueue pending;        // Calls waiting for the key
+} sender_t;
+
+// Everything runs on the GTK main loop so none of this needs locking
+static request_queue_t requests;
+static request_queue_t flushed;   // Cancelled but not freed yet
+static request_t *current = NULL;
+static bool debug = false;
+static int preempt_priority;
+static int digest_threshold;
+static int rate_limit;            // Requests per minute or zero
+static int rate_burst;
+static GHashTable *buckets;       // Token bucket for each client key
+static GHashTable *senders;       // Connection names to sender_t or NULL
+static bool journalling = false;
+static bool prerender;
+static prepared_cow_t *prepared = NULL;   // Bubble for the next request
+static guint32 prepared_id = 0;
+static int prepared_repeat = 0;
+static guint prepare_source = 0;
 
-static void cowsayd_init(Cowsay *server);
-static void cowsayd_class_init(CowsayClass *class);
+static GDBusNodeInfo *introspection_data = NULL;
+static GDBusConnection *bus = NULL;
 
-static gboolean cowsay_show_cow(Cowsay *obj, const gchar *mess, GError **error);
-static gboolean cowsay_think(Cowsay *obj, const gchar *mess, GError **error);
-static gboolean cowsay_dream(Cowsay *obj, const gchar *file, GError **error);
+static void display_next_request(void);
+static void on_name_owner_changed(GDBusConnection *connection,
+                                  const gchar *sender_name,
+                                  const gchar *object_path,
+                                  const gchar *interface_name,
+                                  const gchar *signal_name,
+                                  GVariant *parameters,
+                                  gpointer user_data);
 
-G_DEFINE_TYPE(Cowsay, cowsayd, G_TYPE_OBJECT);
+static const char *reason_name(dismiss_reason_t reason)
+{
+   switch (reason) {
+   case DISMISS_TIMEOUT:
+      return "timeout";
+   case DISMISS_CLICKED:
+      return "clicked";
+   case DISMISS_DROPPED:
+      return "dropped";
+   case DISMISS_CANCELLED:
+      return "cancelled";
+   case DISMISS_PREEMPTED:
+      return "preempted";
+   case DISMISS_EXPIRED:
+      return "expired";
+   case DISMISS_DIGESTED:
+      return "digested";
+   default:
+      g_assert_not_reached();
+   }
+}
 
-#include "Cowsay_glue.h"
+// Broadcast a signal about one of our requests
+static void emit_signal(const char *name, GVariant *parameters)
+{
+   if (NULL == bus) {
+      g_variant_unref(g_variant_ref_sink(parameters));
+      return;
+   }
 
-typedef struct _cowsay_queue_t {
-   struct _cowsay_queue_t *next;
-   char *message;
-   cowmode_t mode;
-} cowsay_queue_t;
-
-static cowsay_queue_t *requests = NULL;
-static GMutex *queue_lock = NULL;
-static GCond *request_ready = NULL;
-static GMutex *display_lock = NULL;
-static GCond *display_complete = NULL;
-
-#define QUEUE_MUTEX_LOCK g_mutex_lock(queue_lock)
-#define QUEUE_MUTEX_UNLOCK g_mutex_unlock(queue_lock)
-#define REQUEST_READY_WAIT g_cond_wait(request_ready, queue_lock)
-#define REQUEST_READY_SIGNAL g_cond_signal(request_ready)
-
-static void enqueue_request(const char *mess, cowmode_t mode)
-{
-   cowsay_queue_t *req = (cowsay_queue_t*)malloc(sizeof(cowsay_queue_t));
-   req->next = NULL;
-   req->message = malloc(strlen(mess)+1);
-   req->mode = mode;
-   g_assert(req->message);
-   strcpy(req->message, mess);
-
-   // Append the request to the end of the queue
-   QUEUE_MUTEX_LOCK;
-   {
-      if (NULL == requests) {
-         requests = req;
+   GError *error = NULL;
+   if (!g_dbus_connection_emit_signal(bus, NULL, XCOWSAY_PATH,
+                                      XCOWSAY_NAMESPACE, name, parameters,
+                                      &error)) {
+      g_warning("Failed to emit %s: %s", name, error->message);
+      g_error_free(error);
+   }
+}
+
+static void emit_dismissed(guint32 id, dismiss_reason_t reason)
+{
+   debug_msg("Request %u dismissed (%s)\n", id, reason_name(reason));
+   emit_signal("Dismissed", g_variant_new("(us)", id, reason_name(reason)));
+
+   notifications_dismissed(id, reason);
+   journal_complete(id);
+}
+
+static void cow_complete(dismiss_reason_t reason, gpointer data)
+{
+   g_assert(current);
+   emit_dismissed(current->id, reason);
+
+   use_settings(NULL);
+   request_free(current);
+   current = NULL;
+
+   display_next_request();
+}
+
+/*
+ * Start rendering the bubble for the request after the one on screen
+ * so it can be shown as soon as the current cow goes away.
+ */
+static gboolean prepare_next(gpointer data)
+{
+   prepare_source = 0;
+
+   request_t *next = queue_first(&requests);
+   if (NULL == current || NULL == next)
+      return G_SOURCE_REMOVE;
+   else if (next->id == prepared_id && next->repeat == prepared_repeat)
+      return G_SOURCE_REMOVE;   // Already done
+
+   free_prepared_cow(prepared);
+
+   settings_t *prev = use_settings(next->settings);
+   char *text = request_text(next);
+   prepared = prepare_cow(debug, text, next->mode);
+   g_free(text);
+   use_settings(prev);
+
+   // Do not try again for the same request if it could not be prepared
+   prepared_id = next->id;
+   prepared_repeat = next->repeat;
+
+   return G_SOURCE_REMOVE;
+}
+
+static void schedule_prepare(void)
+{
+   if (prerender && current != NULL && 0 == prepare_source)
+      prepare_source = g_idle_add_full(G_PRIORITY_LOW, prepare_next,
+                                       NULL, NULL);
+}
+
+static void display_next_request(void)
+{
+   g_assert(NULL == current);
+
+   const gint64 now = g_get_monotonic_time();
+   while (NULL != (current = queue_pop(&requests))) {
+      if (0 == current->deadline || now < current->deadline)
+         break;
+
+      debug_msg("Request %u expired after %.1fms\n", current->id,
+                (now - current->enqueued) / 1000.0);
+      emit_dismissed(current->id, DISMISS_EXPIRED);
+      request_free(current);
+   }
+
+   if (NULL == current)
+      return;
+
+   debug_msg("Processing request %u: %s (queued for %.1fms)\n",
+             current->id, current->message,
+             (now - current->enqueued) / 1000.0);
+
+   emit_signal("Displayed", g_variant_new("(u)", current->id));
+
+   // These stay in effect until the cow has gone away
+   use_settings(current->settings);
+
+   // The prepared bubble is checked again before it is used
+   prepared_cow_t *bubble = NULL;
+   if (current->id == prepared_id)
+      bubble = prepared;
+   else
+      free_prepared_cow(prepared);
+   prepared = NULL;
+   prepared_id = 0;
+
+   if (debug)
+      time_next_cow(current->enqueued);
+
+   char *text = request_text(current);
+   display_prepared_cow(debug, text, current->mode, bubble,
+                        cow_complete, NULL);
+   g_free(text);
+
+   schedule_prepare();
+}
+
+static bool is_request_option(const char *name)
+{
+   for (const char **it = request_options; *it != NULL; it++) {
+      if (strcmp(*it, name) == 0)
+         return true;
+   }
+   return false;
+}
+
+/*
+ * Make a snapshot of the daemon's settings with the client's options
+ * applied.  Unknown options are ignored so older daemons work with
+ * newer clients.
+ */
+static bool request_settings(GVariant *options, settings_t **result,
+                             GError **error)
+{
+   *result = NULL;
+   if (g_variant_n_children(options) == 0)
+      return true;
+
+   settings_t *settings = copy_settings();
+   settings_t *prev = use_settings(settings);
+
+   GVariantIter iter;
+   const gchar *key;
+   GVariant *value;
+   g_variant_iter_init(&iter, options);
+   while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+      bool ok = true;
+      if (is_request_option(key))
+         ok = set_option_from_variant(key, value);
+      else if (strcmp(key, "replaces") != 0
+               && strcmp(key, "priority") != 0
+               && strcmp(key, "coalesce") != 0) {
+         debug_msg("Ignoring unknown option %s\n", key);
       }
-      else {
-         cowsay_queue_t *it;
-         for (it = requests; it->next; it = it->next);
-         it->next = req;
+
+      if (!ok) {
+         g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                     "Option %s cannot have type %s", key,
+                     g_variant_get_type_string(value));
+         g_variant_unref(value);
+         use_settings(prev);
+         free_settings(settings);
+         return false;
       }
-      REQUEST_READY_SIGNAL;
+
+      g_variant_unref(value);
+   }
+
+   use_settings(prev);
+   *result = settings;
+   return true;
+}
+
+static const char *mode_name(cowmode_t mode)
+{
+   switch (mode) {
+   case COWMODE_NORMAL:
+      return "say";
+   case COWMODE_THINK:
+      return "think";
+   case COWMODE_DREAM:
+      return "dream";
+   default:
+      g_assert_not_reached();
    }
-   QUEUE_MUTEX_UNLOCK;
 }
 
-static void wait_for_request(const char** mess, cowmode_t *mode)
+static bool parse_mode_name(const char *name, cowmode_t *mode)
 {
-   QUEUE_MUTEX_LOCK;
-   {
-      while (NULL == requests) {
-         REQUEST_READY_WAIT;
+   if (strcmp(name, "say") == 0)
+      *mode = COWMODE_NORMAL;
+   else if (strcmp(name, "think") == 0)
+      *mode = COWMODE_THINK;
+   else if (strcmp(name, "dream") == 0)
+      *mode = COWMODE_DREAM;
+   else
+      return false;
+
+   return true;
+}
+
+bool daemon_check_mode(const char *name, cowmode_t *mode, GError **error)
+{
+   if (parse_mode_name(name, mode))
+      return true;
+
+   g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+               "Invalid mode '%s'", name);
+   return false;
+}
+
+/*
+ * Look up one of the options which belong to the request itself rather
+ * than the settings.  The value is left as NULL if it is not present.
+ */
+static bool request_option(GVariant *options, const char *name,
+                           const GVariantType *type, GVariant **value,
+                           GError **error)
+{
+   *value = g_variant_lookup_value(options, name, NULL);
+   if (*value != NULL && !g_variant_is_of_type(*value, type)) {
+      g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                  "Option %s cannot have type %s", name,
+                  g_variant_get_type_string(*value));
+      g_variant_unref(*value);
+      *value = NULL;
+      return false;
+   }
+
+   return true;
+}
+
+static request_t *make_request(cowmode_t mode, const char *mess,
+                               GVariant *options, GError **error)
+{
+   GVariant *value;
+
+   guint32 replaces = 0;
+   if (!request_option(options, "replaces", G_VARIANT_TYPE_UINT32,
+                       &value, error))
+      return NULL;
+   else if (value != NULL) {
+      replaces = g_variant_get_uint32(value);
+      g_variant_unref(value);
+   }
+
+   int priority = PRIORITY_NORMAL;
+   if (!request_option(options, "priority", G_VARIANT_TYPE_INT32,
+                       &value, error))
+      return NULL;
+   else if (value != NULL) {
+      priority = g_variant_get_int32(value);
+      g_variant_unref(value);
+
+      if (priority < 0 || priority >= NUM_PRIORITIES) {
+         g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                     "Priority must be between 0 and %d",
+                     NUM_PRIORITIES - 1);
+         return NULL;
       }
-      *mess = requests->message;
-      *mode = requests->mode;
    }
-   QUEUE_MUTEX_UNLOCK;
+
+   bool coalesce = true;
+   if (!request_option(options, "coalesce", G_VARIANT_TYPE_BOOLEAN,
+                       &value, error))
+      return NULL;
+   else if (value != NULL) {
+      coalesce = g_variant_get_boolean(value);
+      g_variant_unref(value);
+   }
+
+   settings_t *settings;
+   if (!request_settings(options, &settings, error))
+      return NULL;
+
+   request_t *req = request_new(mess, mode, settings);
+   req->replaces = replaces;
+   req->priority = priority;
+   req->coalesce = coalesce;
+
+   settings_t *prev = use_settings(settings);
+   const int ttl = get_int_option("ttl");
+   use_settings(prev);
+
+   if (ttl > 0)
+      req->deadline = req->enqueued + ttl * G_GINT64_CONSTANT(1000);
+
+   return req;
 }
 
-static void request_complete()
+/*
+ * Write a request to the journal with whichever of its settings a
+ * client is allowed to change.
+ */
+static void journal_request(const request_t *req)
 {
-   QUEUE_MUTEX_LOCK;
-   {
-      cowsay_queue_t *req = requests;
-      g_assert(req);
-      requests = req->next;
-      free(req->message);
-      free(req);
+   if (!journalling)
+      return;
+
+   GVariantBuilder options;
+   g_variant_builder_init(&options, G_VARIANT_TYPE("a{sv}"));
+
+   if (req->settings != NULL) {
+      settings_t *prev = use_settings(req->settings);
+      GVariant *modified = g_variant_ref_sink(modified_options());
+      use_settings(prev);
+
+      GVariantIter iter;
+      const gchar *key;
+      GVariant *value;
+      g_variant_iter_init(&iter, modified);
+      while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+         if (is_request_option(key))
+            g_variant_builder_add(&options, "{sv}", key, value);
+         g_variant_unref(value);
+      }
+
+      g_variant_unref(modified);
    }
-   QUEUE_MUTEX_UNLOCK;
+
+   // The monotonic clock does not carry over to the next boot
+   gint64 expires = 0;
+   if (req->deadline != 0)
+      expires = g_get_real_time() + req->deadline - g_get_monotonic_time();
+
+   journal_append(req->id, g_variant_new("(ssixa{sv})", mode_name(req->mode),
+                                         req->message, req->priority,
+                                         expires, &options));
 }
 
-static gpointer cow_display_thread(gpointer data)
+/*
+ * Update the text of an earlier request in place if it is still on
+ * screen or waiting in the queue.  The new request takes over the ID of
+ * the one it replaces.
+ */
+static bool replace_request(request_t *req)
 {
-   bool debug = *(bool*)data;
+   if (current != NULL && current->id == req->replaces) {
+      use_settings(req->settings);
+      if (!update_cow(debug, req->message, req->mode)) {
+         use_settings(current->settings);
+         return false;
+      }
 
-   debug_msg("In the cow display thread\n");
+      debug_msg("Request %u updated on screen\n", current->id);
 
-   g_mutex_lock(display_lock);
+      req->id = current->id;
+      request_free(current);
+      current = req;
+      journal_request(req);
 
-   for (;;) {
-      const char *mess;
-      cowmode_t mode;
-      wait_for_request(&mess, &mode);
-      debug_msg("Processing request: %s\n", mess);
+      emit_signal("Displayed", g_variant_new("(u)", req->id));
+      return true;
+   }
 
-      // We need to wrap the GTK+ stuff in gdk_threads_X since
-      // GTK assumes it is being called from the main thread
-      // (and it isn't here)
-      gdk_threads_enter();
-      display_cow(debug, mess, mode);
-      gdk_threads_leave();
+   request_t *old = queue_find(&requests, req->replaces);
+   if (old != NULL) {
+      debug_msg("Request %u updated in queue\n", old->id);
 
-      g_cond_wait(display_complete, display_lock);
+      if (old->id == prepared_id)
+         prepared_id = 0;   // The text has changed
 
-      request_complete();
+      req->id = old->id;
+      req->enqueued = old->enqueued;
+      queue_replace(&requests, old, req);
+      request_free(old);
+      journal_request(req);
+      schedule_prepare();
+      return true;
    }
 
-   g_mutex_unlock(display_lock);
+   return false;
+}
+
+// Returns false if the queue is full and the request was rejected
+static bool enqueue_request(const char *sender, request_t *req)
+{
+   request_t *evicted;
+   switch (queue_push(&requests, req, &evicted)) {
+   case PUSH_QUEUED:
+      emit_signal("Queued", g_variant_new("(u)", req->id));
+      journal_request(req);
+      if (current != NULL && req->priority >= preempt_priority
+          && req->priority > current->priority) {
+         debug_msg("Request %u preempts request %u\n", req->id, current->id);
+         dismiss_cow(DISMISS_PREEMPTED);
+      }
+      schedule_prepare();
+      break;
+   case PUSH_REJECTED:
+      debug_msg("Queue full: rejected request from %s\n", sender);
+      request_free(req);
+      return false;
+   case PUSH_DROPPED:
+      debug_msg("Queue full: dropped request from %s\n", sender);
+      emit_dismissed(req->id, DISMISS_DROPPED);
+      request_free(req);
+      break;
+   }
+
+   if (evicted != NULL) {
+      debug_msg("Queue full: dropped oldest request: %s\n", evicted->message);
+      emit_dismissed(evicted->id, DISMISS_DROPPED);
+      request_free(evicted);
+   }
 
-   return NULL;
+   return true;
 }
 
-static void cowsayd_class_init(CowsayClass *class)
+/*
+ * Merge a request into an identical one on screen or in the queue by
+ * bumping its repeat count.  The request is freed if this succeeds.
+ */
+static bool coalesce_request(request_t *req, guint32 *id)
 {
-   // Nothing to do here
+   if (NULL == requests.index || !req->coalesce)
+      return false;   // Coalescing is disabled
+
+   if (current != NULL && current->coalesce && request_equal(current, req)) {
+      current->repeat++;
+
+      char *text = request_text(current);
+      const bool updated = update_cow(debug, text, current->mode);
+      g_free(text);
+
+      if (updated) {
+         debug_msg("Request %u repeated on screen (%d times)\n",
+                   current->id, current->repeat);
+         *id = current->id;
+         request_free(req);
+         return true;
+      }
+
+      current->repeat--;
+   }
+
+   request_t *dup = queue_find_equal(&requests, req);
+   if (dup != NULL) {
+      dup->repeat++;
+      debug_msg("Request %u repeated in queue (%d times)\n",
+                dup->id, dup->repeat);
+
+      // Give it the longer of the two lifetimes
+      if (0 == req->deadline || 0 == dup->deadline)
+         dup->deadline = 0;
+      else
+         dup->deadline = MAX(dup->deadline, req->deadline);
+
+      *id = dup->id;
+      request_free(req);
+      schedule_prepare();
+      return true;
+   }
+
+   return false;
 }
 
-static void cowsayd_init(Cowsay *server)
+// Quote the start of the first line of a message as escaped markup
+static void quote_message(GString *quoted, const char *message)
 {
-   GError *error = NULL;
-   DBusGProxy *driver_proxy;
-   guint request_ret;
+   // Cutting the markup itself could leave a tag open
+   char *plain = NULL;
+   if (!pango_parse_markup(message, -1, 0, NULL, &plain, NULL, NULL))
+      plain = g_strdup(message);
 
-   // Initialise the DBus connection
-   server->connection = dbus_g_bus_get(DBUS_BUS_SESSION, &error);
-   if (NULL == server->connection) {
-      g_warning("Unable to connect to DBus: %s", error->message);
-      g_error_free(error);
-      exit(EXIT_FAILURE);
+   char *end = plain;
+   for (int i = 0; i < DIGEST_WIDTH && *end && *end != '\n'; i++)
+      end = g_utf8_next_char(end);
+
+   const bool truncated = (*end != '\0');
+   *end = '\0';
+
+   char *escaped = g_markup_escape_text(plain, -1);
+   g_string_append_printf(quoted, "\n%s%s", escaped,
+                          truncated ? "..." : "");
+   g_free(escaped);
+   g_free(plain);
+}
+
+/*
+ * Replace everything below critical priority with a single bubble
+ * summarising it once the backlog is deeper than digest_threshold.
+ * An earlier digest is folded in by its count rather than quoted.
+ */
+static void digest_backlog(void)
+{
+   if (digest_threshold <= 0 || requests.length <= digest_threshold)
+      return;
+
+   // Replacing a lone request with a digest of itself is pointless
+   int candidates = 0;
+   for (request_t *it = queue_first(&requests);
+        it != NULL && candidates < 2; it = queue_next(&requests, it)) {
+      if (it->priority < PRIORITY_CRITICAL)
+         candidates++;
    }
 
-   dbus_g_object_type_install_info(cowsayd_get_type(),
-                                   &dbus_glib_cowsay_object_info);
+   if (candidates < 2)
+      return;
 
-   // Register DBus path
-   dbus_g_connection_register_g_object(server->connection,
-                                       "/uk/me/doof/Cowsay",
-                                       G_OBJECT(server));
+   GString *quoted = g_string_new(NULL);
+   int messages = 0, digested = 0, shown = 0, shown_messages = 0;
+   int priority = PRIORITY_LOW;
 
-   // Register the service name
-   driver_proxy = dbus_g_proxy_new_for_name(server->connection,
-                                            DBUS_SERVICE_DBUS,
-                                            DBUS_PATH_DBUS,
-                                            DBUS_INTERFACE_DBUS);
-   if (!org_freedesktop_DBus_request_name(driver_proxy,
-                                          "uk.me.doof.Cowsay",
-                                          0, &request_ret, &error)) {
-      g_warning("Unable to register service: %s", error->message);
-      g_error_free(error);
-      exit(EXIT_FAILURE);
+   request_t *it = queue_first(&requests);
+   while (it != NULL) {
+      request_t *next = queue_next(&requests, it);
+
+      if (it->priority < PRIORITY_CRITICAL) {
+         if (it->digested > 0)
+            messages += it->digested;
+         else {
+            if (shown < DIGEST_LINES) {
+               quote_message(quoted, it->message);
+               shown++;
+               shown_messages += it->repeat;
+            }
+            messages += it->repeat;
+         }
+
+         digested++;
+         priority = MAX(priority, it->priority);
+
+         queue_remove(&requests, it);
+         emit_dismissed(it->id, DISMISS_DIGESTED);
+         request_free(it);
+      }
+
+      it = next;
+   }
+
+   if (messages > shown_messages)
+      g_string_append_printf(quoted, "\n(and %d more)",
+                             messages - shown_messages);
+
+   char *text = g_strdup_printf("%d messages were waiting:%s",
+                                messages, quoted->str);
+   g_string_free(quoted, TRUE);
+
+   debug_msg("Digested %d requests\n", digested);
+
+   request_t *req = request_new(text, COWMODE_NORMAL, NULL);
+   req->priority = priority;
+   req->digested = messages;
+   enqueue_request("digest", req);
+
+   g_free(text);
+}
+
+// Called once whenever a client has added requests to the queue
+static void requests_added(void)
+{
+   digest_backlog();
+
+   if (NULL == current)
+      display_next_request();
+}
+
+// Returns zero if the process has gone or this is not Linux
+static pid_t session_id(pid_t pid)
+{
+   char *path = g_strdup_printf("/proc/%d/stat", (int)pid);
+   char *contents = NULL;
+   int sid = 0;
+
+   // The command name in brackets may contain spaces
+   const char *end;
+   if (g_file_get_contents(path, &contents, NULL, NULL)
+       && (end = strrchr(contents, ')')) != NULL)
+      sscanf(end + 1, " %*c %*d %*d %d", &sid);
+
+   g_free(contents);
+   g_free(path);
+   return sid;
+}
+
+static bool is_stock_client(pid_t pid)
+{
+   char *path = g_strdup_printf("/proc/%d/comm", (int)pid);
+   char *comm = NULL;
+
+   bool stock = false;
+   if (g_file_get_contents(path, &comm, NULL, NULL)) {
+      g_strchomp(comm);
+      stock = strcmp(comm, "xcowsay") == 0
+         || strcmp(comm, "xcowsay-send") == 0;
+   }
+
+   g_free(comm);
+   g_free(path);
+   return stock;
+}
+
+/*
+ * xcowsay and xcowsay-send connect once for every message so they are
+ * counted as the session they were run from.  Every other client is
+ * its own process.
+ */
+static char *pid_key(pid_t pid)
+{
+   pid_t sid;
+   if (is_stock_client(pid) && (sid = session_id(pid)) > 0)
+      return g_strdup_printf("session:%d", (int)sid);
+   else
+      return g_strdup_printf("pid:%d", (int)pid);
+}
+
+// Run the calls which were waiting to find out who sent them
+static void resolve_sender(const char *sender, sender_t *s, char *key)
+{
+   s->key = key;
+   debug_msg("Client %s is %s\n", sender, key);
+
+   pending_call_t *p;
+   while ((p = g_queue_pop_head(&(s->pending))) != NULL) {
+      p->call(p->invocation);
+      g_free(p);
    }
+}
 
-   g_object_unref(driver_proxy);
+static void free_sender(gpointer data)
+{
+   sender_t *s = data;
+   g_assert(g_queue_is_empty(&(s->pending)));
+   if (s->subscription != 0 && bus != NULL)
+      g_dbus_connection_signal_unsubscribe(bus, s->subscription);
+   g_free(s->key);
+   g_free(s);
+}
 
+void daemon_track_sender(const char *sender, pid_t pid)
+{
+   if (NULL == senders)
+      return;   // Every connection is a client of its own
+
+   sender_t *s = g_new0(sender_t, 1);
+   g_queue_init(&(s->pending));
+   g_hash_table_replace(senders, g_strdup(sender), s);
+
+   resolve_sender(sender, s, pid_key(pid));
 }
 
-static gboolean cowsay_show_cow(Cowsay *obj, const gchar *mess, GError **error)
+static void on_process_id(GObject *source, GAsyncResult *result,
+                          gpointer user_data)
 {
-   printf("cowsay_show_cow mess=%s\n", mess);
-   enqueue_request(mess, COWMODE_NORMAL);
+   char *sender = user_data;
+
+   GError *error = NULL;
+   GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                   result, &error);
+
+   // It may have been forgotten already if it disconnected
+   sender_t *s = g_hash_table_lookup(senders, sender);
+   if (s != NULL && NULL == reply) {
+      debug_msg("Cannot find process for %s: %s\n", sender, error->message);
+      resolve_sender(sender, s, g_strdup(sender));
+   }
+   else if (s != NULL) {
+      guint32 pid;
+      g_variant_get(reply, "(u)", &pid);
+      resolve_sender(sender, s, pid_key(pid));
+   }
+
+   if (reply != NULL)
+      g_variant_unref(reply);
+   if (error != NULL)
+      g_error_free(error);
+   g_free(sender);
+}
+
+bool daemon_defer_call(GDBusMethodInvocation *invocation, daemon_call_t call)
+{
+   const char *sender = g_dbus_method_invocation_get_sender(invocation);
+   if (NULL == senders || NULL == bus || NULL == sender || sender[0] != ':')
+      return false;
+
+   sender_t *s = g_hash_table_lookup(senders, sender);
+   if (s != NULL && s->key != NULL)
+      return false;   // Already known
+   else if (NULL == s) {
+      s = g_new0(sender_t, 1);
+      g_queue_init(&(s->pending));
+      g_hash_table_insert(senders, g_strdup(sender), s);
+
+      // Subscribe first so we hear if it goes away during the call
+      s->subscription = g_dbus_connection_signal_subscribe(
+         bus, "org.freedesktop.DBus", "org.freedesktop.DBus",
+         "NameOwnerChanged", "/org/freedesktop/DBus", sender,
+         G_DBUS_SIGNAL_FLAGS_NONE, on_name_owner_changed, NULL, NULL);
+
+      g_dbus_connection_call(
+         bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+         "org.freedesktop.DBus", "GetConnectionUnixProcessID",
+         g_variant_new("(s)", sender), G_VARIANT_TYPE("(u)"),
+         G_DBUS_CALL_FLAGS_NONE, RESOLVE_TIMEOUT, NULL, on_process_id,
+         g_strdup(sender));
+   }
+
+   // The handler takes over our reference to the invocation later
+   pending_call_t *p = g_new(pending_call_t, 1);
+   p->invocation = invocation;
+   p->call = call;
+   g_queue_push_tail(&(s->pending), p);
    return true;
 }
 
-static gboolean cowsay_think(Cowsay *obj, const gchar *mess, GError **error)
+/*
+ * Find the client which a connection belongs to.  Connections are
+ * their own client unless grouping by session is enabled and senders
+ * such as the journal are always their own client.
+ */
+static const char *client_key(const char *sender)
+{
+   sender_t *s;
+   if (NULL == sender || NULL == senders
+       || NULL == (s = g_hash_table_lookup(senders, sender))
+       || NULL == s->key)
+      return sender;
+   else
+      return s->key;
+}
+
+// A full bucket is the same as no bucket at all
+static gboolean bucket_full(gpointer key, gpointer value, gpointer data)
+{
+   const bucket_t *b = value;
+   const gint64 now = *(const gint64 *)data;
+   return b->tokens + (now - b->updated) * rate_limit / 60e6 >= rate_burst;
+}
+
+/*
+ * Clients are not forgotten when they disconnect as the next message
+ * often comes from a new connection.  Instead their state is dropped
+ * once it would make no difference.
+ */
+static gboolean sweep_clients(gpointer data)
+{
+   const gint64 now = g_get_monotonic_time();
+   g_hash_table_foreach_remove(buckets, bucket_full, (gpointer)&now);
+   queue_forget_idle_senders(&requests);
+
+   return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Take count tokens from the sender's bucket, which refills at
+ * rate_limit tokens a minute up to rate_burst.  Nothing is taken if
+ * there are not enough.
+ */
+static bool take_tokens(const char *sender, int count)
 {
-   printf("cowsay_think mess=%s\n", mess);
-   enqueue_request(mess, COWMODE_THINK);
+   if (rate_limit <= 0 || NULL == sender)
+      return true;
+
+   const gint64 now = g_get_monotonic_time();
+
+   bucket_t *b = g_hash_table_lookup(buckets, sender);
+   if (NULL == b) {
+      b = g_new(bucket_t, 1);
+      b->tokens = rate_burst;
+      g_hash_table_insert(buckets, g_strdup(sender), b);
+   }
+   else {
+      const double refill = (now - b->updated) * rate_limit / 60e6;
+      b->tokens = MIN(b->tokens + refill, rate_burst);
+   }
+   b->updated = now;
+
+   if (b->tokens < count) {
+      debug_msg("Rate limited %d requests from %s\n", count, sender);
+      return false;
+   }
+
+   b->tokens -= count;
    return true;
 }
 
-static gboolean cowsay_dream(Cowsay *obj, const gchar *file, GError **error)
+static GError *rate_limited_error(void)
+{
+   return g_dbus_error_new_for_dbus_error(XCOWSAY_ERROR_RATE_LIMITED,
+                                          "Too many requests");
+}
+
+static bool submit_request(const char *sender, request_t *req, guint32 *id)
+{
+   req->sender = g_strdup(sender);
+
+   if (req->replaces != 0 && replace_request(req)) {
+      *id = req->id;
+      return true;
+   }
+   else if (coalesce_request(req, id))
+      return true;
+
+   // The request may be freed straight away if it is dropped
+   *id = req->id;
+   return enqueue_request(sender, req);
+}
+
+static GError *queue_full_error(void)
 {
-   printf("cowsay_dream file=%s\n", file);
-   enqueue_request(file, COWMODE_DREAM);
+   return g_dbus_error_new_for_dbus_error(XCOWSAY_ERROR_QUEUE_FULL,
+                                          "Request queue is full");
+}
+
+static void return_queue_full(GDBusMethodInvocation *invocation)
+{
+   g_dbus_method_invocation_take_error(invocation, queue_full_error());
+}
+
+bool daemon_submit(const char *sender, const char *message, cowmode_t mode,
+                   GVariant *options, guint32 *id, GError **error)
+{
+   sender = client_key(sender);
+
+   g_variant_ref_sink(options);
+   request_t *req = NULL;
+   if (take_tokens(sender, 1))
+      req = make_request(mode, message, options, error);
+   else
+      g_propagate_error(error, rate_limited_error());
+   g_variant_unref(options);
+
+   if (NULL == req)
+      return false;
+   else if (!submit_request(sender, req, id)) {
+      g_propagate_error(error, queue_full_error());
+      return false;
+   }
+
+   requests_added();
    return true;
 }
 
-void run_cowsay_daemon(bool debug, int argc, char **argv)
+bool daemon_cancel(guint32 id)
+{
+   if (current != NULL && current->id == id) {
+      debug_msg("Cancelling request %u on screen\n", id);
+      dismiss_cow(DISMISS_CANCELLED);
+      return true;
+   }
+
+   request_t *req = queue_find(&requests, id);
+   if (req != NULL) {
+      debug_msg("Cancelling queued request %u\n", id);
+      queue_remove(&requests, req);
+      emit_dismissed(id, DISMISS_CANCELLED);
+      request_free(req);
+      return true;
+   }
+
+   return false;
+}
+
+// The original methods which only take the message and return nothing
+static void handle_show_legacy(const gchar *sender, const gchar *method_name,
+                               GVariant *parameters,
+                               GDBusMethodInvocation *invocation,
+                               cowmode_t mode)
+{
+   const gchar *mess;
+   g_variant_get(parameters, "(&s)", &mess);
+   debug_msg("%s mess=%s\n", method_name, mess);
+
+   // Coalescing and the default ttl apply as they do for Show
+   guint32 id;
+   GError *error = NULL;
+   if (daemon_submit(sender, mess, mode, g_variant_new("a{sv}", NULL),
+                     &id, &error))
+      g_dbus_method_invocation_return_value(invocation, NULL);
+   else
+      g_dbus_method_invocation_take_error(invocation, error);
+}
+
+static void handle_show(const gchar *sender, GVariant *parameters,
+                        GDBusMethodInvocation *invocation)
+{
+   const gchar *mode_name, *mess;
+   GVariant *options;
+   g_variant_get(parameters, "(&s&s@a{sv})", &mode_name, &mess, &options);
+   debug_msg("Show mode=%s mess=%s\n", mode_name, mess);
+
+   cowmode_t mode;
+   guint32 id;
+   GError *error = NULL;
+   if (daemon_check_mode(mode_name, &mode, &error)
+       && daemon_submit(sender, mess, mode, options, &id, &error))
+      g_dbus_method_invocation_return_value(invocation,
+                                            g_variant_new("(u)", id));
+   else
+      g_dbus_method_invocation_take_error(invocation, error);
+
+   g_variant_unref(options);
+}
+
+/*
+ * Either every message in the batch is queued or, if any of them are
+ * invalid or the queue does not have room for all of them, none are.
+ */
+static void handle_batch(const gchar *sender, GVariant *parameters,
+                         GDBusMethodInvocation *invocation)
+{
+   GVariant *batch = g_variant_get_child_value(parameters, 0);
+   const gsize count = g_variant_n_children(batch);
+
+   sender = client_key(sender);
+
+   request_t **reqs = g_new0(request_t *, count);
+
+   GVariantIter iter;
+   const gchar *mode_name, *mess;
+   GVariant *options;
+   GError *error = NULL;
+   gsize n = 0;
+
+   g_variant_iter_init(&iter, batch);
+   while (g_variant_iter_next(&iter, "(&s&s@a{sv})",
+                              &mode_name, &mess, &options)) {
+      cowmode_t mode;
+      if (daemon_check_mode(mode_name, &mode, &error))
+         reqs[n] = make_request(mode, mess, options, &error);
+      g_variant_unref(options);
+      if (reqs[n++] == NULL)
+         break;
+   }
+
+   if (error == NULL && requests.policy == QUEUE_REJECT
+       && queue_room(&requests) < count) {
+      debug_msg("Queue full: rejected batch of %d from %s\n",
+                (int)count, sender);
+      return_queue_full(invocation);
+   }
+   else if (error == NULL && !take_tokens(sender, count))
+      g_dbus_method_invocation_take_error(invocation, rate_limited_error());
+   else if (error == NULL) {
+      debug_msg("Batch of %d from %s\n", (int)count, sender);
+
+      GVariantBuilder ids;
+      g_variant_builder_init(&ids, G_VARIANT_TYPE("au"));
+
+      for (gsize i = 0; i < count; i++) {
+         guint32 id;
+         submit_request(sender, reqs[i], &id);
+         g_variant_builder_add(&ids, "u", id);
+         reqs[i] = NULL;
+      }
+
+      g_dbus_method_invocation_return_value(invocation,
+                                            g_variant_new("(au)", &ids));
+      requests_added();
+   }
+   else
+      g_dbus_method_invocation_take_error(invocation, error);
+
+   for (gsize i = 0; i < n; i++) {
+      if (reqs[i] != NULL)
+         request_free(reqs[i]);
+   }
+
+   g_free(reqs);
+   g_variant_unref(batch);
+}
+
+static void handle_list(GDBusMethodInvocation *invocation)
+{
+   const gint64 now = g_get_monotonic_time();
+
+   GVariantBuilder list;
+   g_variant_builder_init(&list, G_VARIANT_TYPE("a(usut)"));
+   for (request_t *it = queue_first(&requests); it != NULL;
+        it = queue_next(&requests, it)) {
+      const guint64 age_ms = (now - it->enqueued) / 1000;
+      g_variant_builder_add(&list, "(usut)", it->id, mode_name(it->mode),
+                            (guint32)strlen(it->message), age_ms);
+   }
+
+   g_dbus_method_invocation_return_value(invocation,
+                                         g_variant_new("(a(usut))", &list));
+}
+
+static void handle_cancel(GVariant *parameters,
+                          GDBusMethodInvocation *invocation)
+{
+   guint32 id;
+   g_variant_get(parameters, "(u)", &id);
+
+   const gboolean found = daemon_cancel(id);
+   g_dbus_method_invocation_return_value(invocation,
+                                         g_variant_new("(b)", found));
+}
+
+// Free a few of the flushed requests at a time to keep the daemon responsive
+static gboolean drain_flushed(gpointer data)
+{
+   for (int i = 0; i < DRAIN_BATCH && flushed.length > 0; i++) {
+      request_t *req = queue_pop(&flushed);
+      emit_dismissed(req->id, DISMISS_CANCELLED);
+      request_free(req);
+   }
+
+   if (flushed.length > 0)
+      return true;
+
+   // The old lookup tables of the queue go once the requests have
+   queue_free_retired(&flushed);
+   return false;
+}
+
+/*
+ * The whole queue is detached in constant time and the requests are
+ * freed and reported as cancelled from an idle callback, which also
+ * frees the hash tables the queue was using.
+ */
+static void handle_flush(GDBusMethodInvocation *invocation)
+{
+   const guint32 count = requests.length;
+   debug_msg("Flushing %u requests\n", count);
+
+   const bool idle = (0 == flushed.length);
+   queue_splice(&flushed, &requests);
+   if (idle && flushed.length > 0)
+      g_idle_add(drain_flushed, NULL);
+   else if (idle)
+      queue_free_retired(&flushed);   // The tables are empty
+
+   g_dbus_method_invocation_return_value(invocation,
+                                         g_variant_new("(u)", count));
+}
+
+static void handle_dismiss(GDBusMethodInvocation *invocation)
+{
+   const gboolean found = (current != NULL);
+   if (found) {
+      debug_msg("Dismissing request %u\n", current->id);
+      dismiss_cow(DISMISS_CANCELLED);
+   }
+
+   g_dbus_method_invocation_return_value(invocation,
+                                         g_variant_new("(b)", found));
+}
+
+static void handle_statistics(GDBusMethodInvocation *invocation)
 {
+   bubble_cache_stats_t stats;
+   bubble_cache_stats(&stats);
+
+   GVariantDict dict;
+   g_variant_dict_init(&dict, NULL);
+   g_variant_dict_insert(&dict, "queued", "u", (guint32)requests.length);
+   g_variant_dict_insert(&dict, "bubble_cache_hits", "t", stats.hits);
+   g_variant_dict_insert(&dict, "bubble_cache_misses", "t", stats.misses);
+   g_variant_dict_insert(&dict, "bubble_cache_evictions", "t",
+                         stats.evictions);
+   g_variant_dict_insert(&dict, "bubble_cache_entries", "u", stats.entries);
+   g_variant_dict_insert(&dict, "bubble_cache_bytes", "t",
+                         (guint64)stats.bytes);
+
+   g_dbus_method_invocation_return_value(
+      invocation, g_variant_new("(@a{sv})", g_variant_dict_end(&dict)));
+}
+
+static bool adds_requests(const char *method_name)
+{
+   return g_strcmp0(method_name, "ShowCow") == 0
+      || g_strcmp0(method_name, "Think") == 0
+      || g_strcmp0(method_name, "Dream") == 0
+      || g_strcmp0(method_name, "Show") == 0
+      || g_strcmp0(method_name, "ShowBatch") == 0;
+}
+
+static void redo_method_call(GDBusMethodInvocation *invocation);
+
+static void handle_method_call(GDBusConnection *connection,
+                               const gchar *sender,
+                               const gchar *object_path,
+                               const gchar *interface_name,
+                               const gchar *method_name,
+                               GVariant *parameters,
+                               GDBusMethodInvocation *invocation,
+                               gpointer user_data)
+{
+   // Requests wait until we know which client sent them
+   if (adds_requests(method_name)
+       && daemon_defer_call(invocation, redo_method_call))
+      return;
+
+   if (g_strcmp0(method_name, "ShowCow") == 0)
+      handle_show_legacy(sender, method_name, parameters, invocation,
+                         COWMODE_NORMAL);
+   else if (g_strcmp0(method_name, "Think") == 0)
+      handle_show_legacy(sender, method_name, parameters, invocation,
+                         COWMODE_THINK);
+   else if (g_strcmp0(method_name, "Dream") == 0)
+      handle_show_legacy(sender, method_name, parameters, invocation,
+                         COWMODE_DREAM);
+   else if (g_strcmp0(method_name, "Show") == 0)
+      handle_show(sender, parameters, invocation);
+   else if (g_strcmp0(method_name, "ShowBatch") == 0)
+      handle_batch(sender, parameters, invocation);
+   else if (g_strcmp0(method_name, "ListRequests") == 0)
+      handle_list(invocation);
+   else if (g_strcmp0(method_name, "Cancel") == 0)
+      handle_cancel(parameters, invocation);
+   else if (g_strcmp0(method_name, "Flush") == 0)
+      handle_flush(invocation);
+   else if (g_strcmp0(method_name, "Dismiss") == 0)
+      handle_dismiss(invocation);
+   else if (g_strcmp0(method_name, "GetStatistics") == 0)
+      handle_statistics(invocation);
+   else {
+      g_dbus_method_invocation_return_error(
+         invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+         "Unknown method %s", method_name);
+      return;
+   }
+
+   if (NULL == current)
+      display_next_request();
+}
+
+static void redo_method_call(GDBusMethodInvocation *invocation)
+{
+   handle_method_call(
+      g_dbus_method_invocation_get_connection(invocation),
+      g_dbus_method_invocation_get_sender(invocation),
+      g_dbus_method_invocation_get_object_path(invocation),
+      g_dbus_method_invocation_get_interface_name(invocation),
+      g_dbus_method_invocation_get_method_name(invocation),
+      g_dbus_method_invocation_get_parameters(invocation),
+      invocation, NULL);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+   handle_method_call,
+   NULL,
+   NULL
+};
+
+void daemon_forget_sender(const char *sender)
+{
+   sender_t *s;
+   if (NULL == senders || NULL == (s = g_hash_table_lookup(senders, sender)))
+      return;
+
+   // Gone before we found out which process it was
+   if (NULL == s->key)
+      resolve_sender(sender, s, g_strdup(sender));
+
+   g_hash_table_remove(senders, sender);
+}
+
+// Queue a request left over from the last time the daemon ran
+static void replay_request(GVariant *record, gpointer data)
+{
+   if (!g_variant_is_of_type(record, G_VARIANT_TYPE("(ssixa{sv})"))) {
+      debug_msg("Ignoring journal record of type %s\n",
+                g_variant_get_type_string(record));
+      return;
+   }
+
+   const gchar *name, *mess;
+   gint32 priority;
+   gint64 expires;
+   GVariant *options;
+   g_variant_get(record, "(&s&six@a{sv})", &name, &mess, &priority,
+                 &expires, &options);
+
+   cowmode_t mode;
+   request_t *req = NULL;
+   GError *error = NULL;
+   if (daemon_check_mode(name, &mode, &error))
+      req = make_request(mode, mess, options, &error);
+   g_variant_unref(options);
+
+   if (NULL == req) {
+      g_warning("Cannot replay request: %s", error->message);
+      g_error_free(error);
+      return;
+   }
+
+   if (priority >= 0 && priority < NUM_PRIORITIES)
+      req->priority = priority;
+
+   if (expires != 0) {
+      const gint64 remaining = expires - g_get_real_time();
+      req->deadline = MAX(req->enqueued + remaining, 1);
+   }
+
+   enqueue_request("journal", req);
+}
+
+// Only subscribed for the names of connections we are tracking
+static void on_name_owner_changed(GDBusConnection *connection,
+                                  const gchar *sender_name,
+                                  const gchar *object_path,
+                                  const gchar *interface_name,
+                                  const gchar *signal_name,
+                                  GVariant *parameters,
+                                  gpointer user_data)
+{
+   const gchar *name, *old_owner, *new_owner;
+   g_variant_get(parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+
+   if (*old_owner == '\0' || *new_owner != '\0')
+      return;
+
+   daemon_forget_sender(old_owner);
+}
+
+static void on_bus_acquired(GDBusConnection *connection, const gchar *name,
+                            gpointer user_data)
+{
+   GError *error = NULL;
+   guint id = g_dbus_connection_register_object(
+      connection, XCOWSAY_PATH, introspection_data->interfaces[0],
+      &interface_vtable, NULL, NULL, &error);
+   if (0 == id) {
+      g_warning("Unable to register object: %s", error->message);
+      g_error_free(error);
+      exit(EXIT_FAILURE);
+   }
+
+   bus = connection;
+}
+
+static void on_name_acquired(GDBusConnection *connection, const gchar *name,
+                             gpointer user_data)
+{
+   debug_msg("Acquired name %s\n", name);
+
+   // Only now is it safe to replace a socket left by an old daemon
+   if (get_bool_option("socket"))
+      socket_server_init(debug);
+}
+
+static void on_name_lost(GDBusConnection *connection, const gchar *name,
+                         gpointer user_data)
+{
+   if (NULL == connection)
+      g_warning("Unable to connect to DBus");
+   else
+      g_warning("Unable to register service %s", name);
+   exit(EXIT_FAILURE);
+}
+
+void run_cowsay_daemon(bool debug_flag, int argc, char **argv)
+{
+   debug = debug_flag;
+
+   queue_policy_t policy;
+   const char *policy_str = get_string_option("queue_full");
+   if (!parse_queue_policy(policy_str, &policy)) {
+      fprintf(stderr, "Error: invalid queue_full policy '%s'\n", policy_str);
+      exit(EXIT_FAILURE);
+   }
+
+   queue_init(&requests, get_int_option("queue_size"), policy,
+              get_bool_option("coalesce"));
+   queue_init(&flushed, 0, QUEUE_REJECT, false);
+
+   preempt_priority = get_int_option("preempt_priority");
+   digest_threshold = get_int_option("digest_threshold");
+   rate_limit = get_int_option("rate_limit");
+   rate_burst = get_int_option("rate_burst");
+   prerender = get_bool_option("prerender");
+
+   buckets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+   if (rate_limit > 0 && get_bool_option("group_by_session"))
+      senders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      free_sender);
+
    if (!debug) {
       // Fork away from the terminal
       int pid = fork();
@@ -251,30 +1482,41 @@ void run_cowsay_daemon(bool debug, int argc, char **argv)
       dup(fd);   // stderr
    }
 
-   // g_thread_init must come before all other GLib calls
-   g_thread_init(NULL);
-   gdk_threads_init();
+   cowsay_init(&argc, &argv);
 
-   queue_lock = g_mutex_new();
-   request_ready = g_cond_new();
-   display_complete = g_cond_new();
-   display_lock = g_mutex_new();
+   // Clients wait until we own the name so do this first
+   if (get_bool_option("warm_up"))
+      warm_up_bubbles(debug);
 
-   cowsay_init(&argc, &argv);
+   introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+   g_assert(introspection_data);
+
+   // Replay before taking the name so nothing new jumps ahead
+   if (get_bool_option("journal"))
+      journalling = journal_open(debug, replay_request, NULL);
+
+   if (NULL == current)
+      display_next_request();
 
-   g_type_init();
-   Cowsay *server = g_object_new(cowsayd_get_type(), NULL);
+   guint owner_id = g_bus_own_name(G_BUS_TYPE_SESSION, XCOWSAY_NAMESPACE,
+                                   G_BUS_NAME_OWNER_FLAGS_NONE,
+                                   on_bus_acquired, on_name_acquired,
+                                   on_name_lost, NULL, NULL);
 
-   GThread *displ = g_thread_create(cow_display_thread, (gpointer)&debug, FALSE, NULL);
-   g_assert(displ);
+   if (get_bool_option("notifications"))
+      notifications_init(debug);
+
+   g_timeout_add_seconds(SWEEP_INTERVAL, sweep_clients, NULL);
 
    debug_msg("Cowsay daemon starting...\n");
-   for (;;) {
-      gtk_main();
-      g_cond_signal(display_complete);
-   }
+   gtk_main();
 
-   g_object_unref(server);
+   notifications_shutdown();
+   socket_server_shutdown();
+   free_prepared_cow(prepared);
+   journal_close();
+   g_bus_unown_name(owner_id);
+   g_dbus_node_info_unref(introspection_data);
 
    exit(EXIT_SUCCESS);
 }
@@ -5,4 +5,39 @@
 
 void run_cowsay_daemon(bool debug, int argc, char **argv);
 
+#ifdef WITH_DBUS
+
+#include <sys/types.h>
+#include <gio/gio.h>
+
+#include "xcowsay.h"
+
+// Queue a message as if it came from the Show method.  The options are
+// consumed if floating.  Returns false and sets error if the options
+// are invalid or the queue is full.
+bool daemon_submit(const char *sender, const char *message, cowmode_t mode,
+                   GVariant *options, guint32 *id, GError **error);
+
+// Returns false if there is no such request on screen or in the queue
+bool daemon_cancel(guint32 id);
+
+// Parse "say", "think" or "dream" or set error
+bool daemon_check_mode(const char *name, cowmode_t *mode, GError **error);
+
+// Handles a method call which was put off
+typedef void (*daemon_call_t)(GDBusMethodInvocation *invocation);
+
+// Returns true if the call must wait until the process which sent it
+// has been looked up.  Then call is run later with the invocation.
+bool daemon_defer_call(GDBusMethodInvocation *invocation, daemon_call_t call);
+
+// Count requests from a connection as coming from this process
+void daemon_track_sender(const char *sender, pid_t pid);
+
+// Stop tracking a connection once it has closed.  Its rate limit
+// and place in the queue are kept until they make no difference.
+void daemon_forget_sender(const char *sender);
+
+#endif
+
 #endif
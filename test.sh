@@ -38,9 +38,17 @@ pid=$!
 echo "PID is $pid; code is $?"
 sleep 0.5
 
-$BUILD_DIR/src/xcowsay Hello World -t 100
-echo "Sleep for one second"
-sleep 1
+time $BUILD_DIR/src/xcowsay Hello World -t 1 --wait
+
+echo Coalescing only merges identical requests
+send="$BUILD_DIR/src/xcowsay-send --print-id"
+first=$($send -t 1 Same message)
+again=$($send -t 1 Same message)
+longer=$($send -t 2 Same message)
+if [ "$first" != "$again" ] || [ "$first" = "$longer" ]; then
+   echo "Expected $first = $again != $longer"
+   exit 1
+fi
 
 kill $pid
 wait